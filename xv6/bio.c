@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,47 +12,352 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To have a block read in while doing something else, call
+//     breadahead; a later bread finds it in the cache.
 //
-// The implementation uses two state flags internally:
+// The implementation uses these state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_AHEAD: the buffer was read ahead and no bread
+//     has used it yet.
+// * B_DATA: the buffer holds file data, read with breaddata,
+//     rather than metadata.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "x86.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
+
+#define BPG (PGSIZE/BSIZE)  // buffers per page of data
+
+// Buffers are found through a hash table keyed by (dev, blockno),
+// each chain with its own lock, so that looking up and releasing
+// different blocks does not serialize. Unreferenced buffers are
+// also on one of two LRU lists, under bcache.lock, from which
+// bget() takes the buffer to recycle. Evictions take bcache.evict,
+// one at a time, so a block that two processes miss on at once is
+// only cached once.
+//
+// The two lists implement 2Q replacement, so that reading a large
+// file once does not push everything else out. File data starts
+// out on the probationary list, bcache.in, and metadata (inodes,
+// bitmap, directories, indirect blocks, the log) on the hot list,
+// bcache.hot. bget() recycles buffers from bcache.in while it
+// holds more than a quarter of the cache, and otherwise from
+// bcache.hot. The blocks evicted from bcache.in are remembered
+// on a ghost list; if one is read again soon, it has proved
+// itself and goes on bcache.hot. Repeated use while on bcache.in
+// is not enough, since a single read() may look at a block
+// several times.
+//
+// A buffer's refcnt and hash chain link are protected by its
+// bucket's lock; dev and blockno only change with bcache.evict
+// and the buffer's old and new bucket locks held. Lock order is
+// bcache.evict, then bucket locks in index order, then bcache.lock.
+//
+// The cache is sized at boot to BUFMEM percent of free memory.
+// Buffers come and go in groups of BPG that share a page of
+// data: bshrink() gives idle groups back when kalloc() runs out
+// of memory, and bget() grows the cache again, up to that size,
+// once memory is plentiful. Buffers that hold no block are
+// hashed as block n of device 0, which is never read, with
+// B_VALID clear.
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;    // hash chain, through hnext
+  uint hits;
+  uint misses;
+};
+
+struct bufgroup {
+  struct bufgroup *next;   // on bcache.groups or bcache.free
+  char *page;              // data for the group's buffers
+  struct buf buf[BPG];
+};
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct spinlock evict;
+  struct kmem_cache *cache;
+
+  // Linked lists of unreferenced buffers, through prev/next.
+  // next is most recently used. prev/next are zero while a
+  // buffer is off the lists; b->hot says which one it is on.
+  struct buf in;
+  struct buf hot;
+  uint nin;                 // buffers on bcache.in
+
+  struct bucket *bucket;
+  uint nbucket;
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Protected by bcache.evict.
+  struct bufgroup *groups;  // groups in the cache
+  struct bufgroup *free;    // groups given back by bshrink()
+  uint nbuf;
+  uint maxbuf;
+  uint nblank;              // next block number for a blank buffer
+  uint evictions;
+  uint grows;
+  uint shrinks;
+  struct ghost *ghost;       // ring of blocks evicted from bcache.in
+  struct ghost **ghosthash;
+  uint nghost;
+  uint ghostnext;           // oldest ghost, next to be reused
+  uint ghosthits;
+
+  // Counted with xadd(), holding only the buffer's lock.
+  uint ahead;
+  uint aheadused;
+  uint aheadwasted;
+  uint inflight;            // read-aheads not yet done
+  uint metahits;
+  uint metamisses;
+  uint datahits;
+  uint datamisses;
 } bcache;
 
+struct ghost {
+  uint dev;                 // 0 if unused
+  uint blockno;
+  struct ghost *hnext;
+};
+
+static int bgrow(void);
+static int bshrink(int n);
+static void bput(struct buf *b);
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % bcache.nbucket];
+}
+
+// Must come after kinit2(), so that all of memory is free
+// to size the cache by.
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  int order;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evict, "bcache.evict");
+  bcache.cache = kmem_cache_create("bufgroup", sizeof(struct bufgroup));
+  bcache.in.prev = bcache.in.next = &bcache.in;
+  bcache.hot.prev = bcache.hot.next = &bcache.hot;
+
+  bcache.maxbuf = kfreepages() / 100 * BUFMEM * BPG;
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+  bcache.maxbuf = (bcache.maxbuf + BPG-1) / BPG * BPG;
+
+  // Allow about four buffers per hash chain.
+  for(order = 0; order < MAXORDER; order++)
+    if((PGSIZE << order) / sizeof(struct bucket) >= bcache.maxbuf / 4)
+      break;
+  if((bcache.bucket = (struct bucket*)alloc_pages(order)) == 0)
+    panic("binit: bucket");
+  bcache.nbucket = (PGSIZE << order) / sizeof(struct bucket);
+  for(bk = bcache.bucket; bk < &bcache.bucket[bcache.nbucket]; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+    bk->hits = 0;
+    bk->misses = 0;
+  }
+
+  // Remember half as many evicted blocks as there are buffers.
+  bcache.nghost = bcache.maxbuf / 2;
+  for(order = 0; order < MAXORDER; order++)
+    if((PGSIZE << order) / (sizeof(struct ghost) + sizeof(struct ghost*))
+       >= bcache.nghost)
+      break;
+  if((bcache.ghost = (struct ghost*)alloc_pages(order)) == 0)
+    panic("binit: ghost");
+  memset(bcache.ghost, 0, PGSIZE << order);
+  bcache.ghosthash = (struct ghost**)&bcache.ghost[bcache.nghost];
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  while(bcache.nbuf < bcache.maxbuf && bgrow())
+    ;
+  if(bcache.nbuf < NBUF)
+    panic("binit");
+  cprintf("bcache: %d buffers, %d hash chains\n", bcache.nbuf, bcache.nbucket);
+  register_shrinker(bshrink);
+}
+
+// Take b off its list. Caller must hold bcache.lock.
+static void
+unlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->next = b->prev = 0;
+  if(!b->hot)
+    bcache.nin--;
+}
+
+// Put b on the most recently used end of list h.
+// Caller must hold bcache.lock.
+static void
+link(struct buf *h, struct buf *b)
+{
+  b->hot = (h == &bcache.hot);
+  if(!b->hot)
+    bcache.nin++;
+  b->next = h->next;
+  b->prev = h;
+  h->next->prev = b;
+  h->next = b;
+}
+
+// Take b off its list, if it is on one.
+// Caller must hold b's bucket lock.
+static void
+lruremove(struct buf *b)
+{
+  acquire(&bcache.lock);
+  if(b->next)
+    unlink(b);
+  release(&bcache.lock);
+}
+
+static struct ghost**
+ghosthash(uint dev, uint blockno)
+{
+  return &bcache.ghosthash[(dev*31 + blockno) % bcache.nghost];
+}
+
+// Remember that block blockno of dev was evicted from bcache.in,
+// forgetting the oldest such block. Caller must hold bcache.evict.
+static void
+ghostadd(uint dev, uint blockno)
+{
+  struct ghost *g, **pp;
+
+  g = &bcache.ghost[bcache.ghostnext];
+  bcache.ghostnext = (bcache.ghostnext + 1) % bcache.nghost;
+  if(g->dev){
+    for(pp = ghosthash(g->dev, g->blockno); *pp != g; pp = &(*pp)->hnext)
+      ;
+    *pp = g->hnext;
   }
+  g->dev = dev;
+  g->blockno = blockno;
+  pp = ghosthash(dev, blockno);
+  g->hnext = *pp;
+  *pp = g;
+}
+
+// Was block blockno of dev evicted from bcache.in lately?
+// If so, forget it. Caller must hold bcache.evict.
+static int
+ghostfind(uint dev, uint blockno)
+{
+  struct ghost *g, **pp;
+
+  for(pp = ghosthash(dev, blockno); (g = *pp) != 0; pp = &g->hnext){
+    if(g->dev == dev && g->blockno == blockno){
+      *pp = g->hnext;
+      g->dev = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Look for block blockno of device dev in bucket bk and, if it
+// is cached, take a reference to it. Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(b->refcnt++ == 0)
+        lruremove(b);
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Take b out of its bucket's hash chain.
+// Caller must hold the bucket's lock.
+static void
+bunhash(struct bucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+}
+
+// Lock buckets a and b, in index order so that two
+// evictions cannot deadlock.
+static void
+lockbuckets(struct bucket *a, struct bucket *b)
+{
+  if(a > b){
+    lockbuckets(b, a);
+    return;
+  }
+  acquire(&a->lock);
+  if(b != a)
+    acquire(&b->lock);
+}
+
+static void
+unlockbuckets(struct bucket *a, struct bucket *b)
+{
+  if(b != a)
+    release(&b->lock);
+  release(&a->lock);
+}
+
+// The least recently used clean buffer on list h, or 0.
+// Caller must hold bcache.lock.
+static struct buf*
+lruclean(struct buf *h)
+{
+  struct buf *b;
+
+  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+  // because log.c has modified it but not yet committed it.
+  for(b = h->prev; b != h; b = b->prev)
+    if((b->flags & B_DIRTY) == 0)
+      return b;
+  return 0;
+}
+
+// Choose a buffer to recycle and take it off its list.
+// Caller must hold bcache.evict.
+static struct buf*
+victim(void)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  b = 0;
+  if(bcache.nin > bcache.nbuf / 4)
+    b = lruclean(&bcache.in);
+  if(b == 0)
+    b = lruclean(&bcache.hot);
+  if(b == 0)
+    b = lruclean(&bcache.in);
+  if(b == 0)
+    panic("bget: no buffers");
+  unlink(b);
+  release(&bcache.lock);
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -61,48 +366,269 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk, *vk;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = bfind(bk, dev, blockno)) != 0){
+    bk->hits++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Not cached. If the cache has given memory back, and
+  // memory is plentiful again, add blank buffers for
+  // victim() to find.
+  if(bcache.nbuf < bcache.maxbuf && kfreepages() > bcache.maxbuf / BPG)
+    bgrow();
+
+  // Recycle an unused buffer. Look again first:
+  // another eviction may have brought the block in.
+  acquire(&bcache.evict);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    bk->hits++;
+    release(&bk->lock);
+    release(&bcache.evict);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  bk->misses++;
+  release(&bk->lock);
+
+  for(;;){
+    b = victim();
+    vk = bhash(b->dev, b->blockno);
+    lockbuckets(bk, vk);
+    // Someone may have found the buffer in its bucket since
+    // victim() took it; if so it is theirs, or back on the list.
+    if(b->refcnt == 0 && b->next == 0)
+      break;
+    unlockbuckets(bk, vk);
+  }
+
+  if(b->flags & B_VALID){
+    bcache.evictions++;
+    if(!b->hot)
+      ghostadd(b->dev, b->blockno);
+  }
+  if(b->flags & B_AHEAD)
+    bcache.aheadwasted++;
+  bunhash(vk, b);
+  b->hnext = bk->head;
+  bk->head = b;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  if((b->hot = ghostfind(dev, blockno)) != 0)
+    bcache.ghosthits++;
+  unlockbuckets(bk, vk);
+  release(&bcache.evict);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+//PAGEBREAK!
+// Add a group of blank buffers to the cache, at the cold end
+// of bcache.in. Returns 0 if out of memory.
+// Must be called with no bcache locks held, since kalloc()
+// may call bshrink().
+static int
+bgrow(void)
+{
+  struct bufgroup *g;
+  struct bucket *bk;
+  struct buf *b;
+  char *page;
+
+  acquire(&bcache.evict);
+  if((g = bcache.free) != 0)
+    bcache.free = g->next;
+  release(&bcache.evict);
+  if(g == 0 && (g = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  if((page = kalloc()) == 0){
+    acquire(&bcache.evict);
+    g->next = bcache.free;
+    bcache.free = g;
+    release(&bcache.evict);
+    return 0;
+  }
+
+  acquire(&bcache.evict);
+  g->page = page;
+  for(b = g->buf; b < &g->buf[BPG]; b++){
+    memset(b, 0, sizeof(*b));
+    initsleeplock(&b->lock, "buffer");
+    b->data = (uchar*)page + (b - g->buf) * BSIZE;
+    b->blockno = bcache.nblank++;
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    b->hnext = bk->head;
+    bk->head = b;
+    acquire(&bcache.lock);
+    b->prev = bcache.in.prev;
+    b->next = &bcache.in;
+    bcache.in.prev->next = b;
+    bcache.in.prev = b;
+    bcache.nin++;
+    release(&bcache.lock);
+    release(&bk->lock);
+  }
+  g->next = bcache.groups;
+  bcache.groups = g;
+  bcache.nbuf += BPG;
+  bcache.grows++;
+  release(&bcache.evict);
+  return 1;
+}
+
+// Take g's buffers out of the cache if none of them is in use.
+// Returns 1 if it did. Caller must hold bcache.evict.
+static int
+bdropgroup(struct bufgroup *g)
+{
+  struct bucket *bk[BPG], *k;
+  struct buf *b;
+  int i, n, idle;
+
+  // Lock the buckets involved, each once, in index order.
+  n = 0;
+  for(b = g->buf; b < &g->buf[BPG]; b++){
+    k = bhash(b->dev, b->blockno);
+    for(i = 0; i < n && bk[i] != k; i++)
+      ;
+    if(i < n)
+      continue;
+    for(i = n++; i > 0 && bk[i-1] > k; i--)
+      bk[i] = bk[i-1];
+    bk[i] = k;
+  }
+  for(i = 0; i < n; i++)
+    acquire(&bk[i]->lock);
+
+  idle = 1;
+  acquire(&bcache.lock);
+  for(b = g->buf; b < &g->buf[BPG]; b++)
+    if(b->refcnt != 0 || b->next == 0 || (b->flags & B_DIRTY))
+      idle = 0;
+  if(idle)
+    for(b = g->buf; b < &g->buf[BPG]; b++)
+      unlink(b);
+  release(&bcache.lock);
+  if(idle){
+    for(b = g->buf; b < &g->buf[BPG]; b++){
+      bunhash(bhash(b->dev, b->blockno), b);
+      if(b->flags & B_AHEAD)
+        bcache.aheadwasted++;
     }
   }
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  for(i = n-1; i >= 0; i--)
+    release(&bk[i]->lock);
+  return idle;
+}
+
+// Called by kalloc() when memory is short: give back up to
+// n pages of buffer data, a group of idle buffers at a time,
+// keeping at least NBUF buffers. Returns the number of pages
+// freed.
+//
+// kalloc() may be called with a slab cache locked, so the
+// groups go on bcache.free rather than back to the slab.
+static int
+bshrink(int n)
+{
+  struct bufgroup *g, **pp;
+  int got;
+
+  got = 0;
+  acquire(&bcache.evict);
+  pp = &bcache.groups;
+  while((g = *pp) != 0 && got < n && bcache.nbuf - BPG >= NBUF){
+    if(!bdropgroup(g)){
+      pp = &g->next;
+      continue;
     }
+    *pp = g->next;
+    g->next = bcache.free;
+    bcache.free = g;
+    kfree(g->page);
+    bcache.nbuf -= BPG;
+    bcache.shrinks++;
+    got++;
+  }
+  release(&bcache.evict);
+  return got;
+}
+
+static struct buf*
+bfetch(uint dev, uint blockno, int data)
+{
+  struct buf *b;
+  int hit;
+
+  b = bget(dev, blockno);
+  hit = b->flags & B_VALID;
+  if(!hit) {
+    iderw(b);
+  }
+  if(data){
+    b->flags |= B_DATA;
+    xadd(hit ? &bcache.datahits : &bcache.datamisses, 1);
+  } else {
+    b->flags &= ~B_DATA;
+    xadd(hit ? &bcache.metahits : &bcache.metamisses, 1);
   }
-  panic("bget: no buffers");
+  if(b->flags & B_AHEAD){
+    b->flags &= ~B_AHEAD;
+    xadd(&bcache.aheadused, 1);
+  }
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
+{
+  return bfetch(dev, blockno, 0);
+}
+
+// Like bread, for a block of file data, which the cache
+// keeps less eagerly than metadata.
+struct buf*
+breaddata(uint dev, uint blockno)
+{
+  return bfetch(dev, blockno, 1);
+}
+
+// Start reading the indicated block of file data into the
+// cache, if it is not there already, without waiting for the
+// disk.
+void
+breadahead(uint dev, uint blockno)
 {
   struct buf *b;
 
+  // Leave most of the cache for blocks that are in use.
+  if(bcache.inflight >= bcache.nbuf / 8)
+    return;
+
   b = bget(dev, blockno);
-  if((b->flags & B_VALID) == 0) {
-    iderw(b);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
   }
-  return b;
+  b->flags |= B_ASYNC | B_AHEAD;
+  xadd(&bcache.ahead, 1);
+  xadd(&bcache.inflight, 1);
+  iderw(b);
 }
 
 // Write b's contents to disk.  Must be locked.
@@ -116,29 +642,77 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// If no one else holds it, move it to the head of its list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
+  bput(b);
+}
+
+// Release a buffer that breadahead() handed to the disk
+// driver, on behalf of the process that started the read.
+// Called when the read finishes, maybe from an interrupt.
+void
+basyncdone(struct buf *b)
+{
+  xadd(&bcache.inflight, -1);
+  bput(b);
+}
+
+// Unlock b and drop a reference to it.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+  int meta;
+
+  // Look at the flags while b is still locked.
+  meta = (b->flags & (B_DATA|B_AHEAD)) == 0;
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+    acquire(&bcache.lock);
+    link(meta || b->hot ? &bcache.hot : &bcache.in, b);
+    release(&bcache.lock);
+  }
+  release(&bk->lock);
+}
+
+// Copy buffer cache counters out for the bcachestat system call.
+void
+bcachestat(struct bcachestat *st)
+{
+  struct bucket *bk;
+
+  memset(st, 0, sizeof(*st));
+  for(bk = bcache.bucket; bk < &bcache.bucket[bcache.nbucket]; bk++){
+    acquire(&bk->lock);
+    st->hits += bk->hits;
+    st->misses += bk->misses;
+    release(&bk->lock);
+  }
+  acquire(&bcache.evict);
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
+  st->evictions = bcache.evictions;
+  st->grows = bcache.grows;
+  st->shrinks = bcache.shrinks;
+  st->ahead = bcache.ahead;
+  st->aheadused = bcache.aheadused;
+  st->aheadwasted = bcache.aheadwasted;
+  st->metahits = bcache.metahits;
+  st->metamisses = bcache.metamisses;
+  st->datahits = bcache.datahits;
+  st->datamisses = bcache.datamisses;
+  st->ghosthits = bcache.ghosthits;
+  release(&bcache.evict);
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -4,11 +4,18 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int hot;           // on the hot list, or headed there (bio.c)
+  struct buf *hnext; // hash chain
+  struct buf *prev; // LRU list of unreferenced buffers
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qstart;       // when queued, in cycles (iosched.c)
+  uint qdeadline;    // tick by which to start it
+  uchar *data;       // BSIZE bytes, in a page shared with other bufs
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // disk driver releases buffer when done
+#define B_AHEAD 0x10 // read ahead, not yet used
+#define B_DATA  0x20 // file data, not metadata
 
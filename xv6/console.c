@@ -235,10 +235,15 @@ consoleintr(int (*getc)(void))
 int
 consoleread(struct inode *ip, char *dst, int n)
 {
+  char buf[INPUT_BUF];
   uint target;
   int c;
 
   iunlock(ip);
+  // At most a line, gathered in buf: copying to user memory
+  // may fault and sleep, so it is done without cons.lock.
+  if(n > sizeof(buf))
+    n = sizeof(buf);
   target = n;
   acquire(&cons.lock);
   while(n > 0){
@@ -259,7 +264,7 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    buf[target - n] = c;
     --n;
     if(c == '\n')
       break;
@@ -267,19 +272,32 @@ consoleread(struct inode *ip, char *dst, int n)
   release(&cons.lock);
   ilock(ip);
 
+  if(umemcpy(dst, buf, target - n) < 0)
+    return -1;
   return target - n;
 }
 
 int
-consolewrite(struct inode *ip, char *buf, int n)
+consolewrite(struct inode *ip, char *src, int n)
 {
-  int i;
+  char buf[128];
+  int i, j, m;
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  // Copy from user memory outside cons.lock; see consoleread().
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(umemcpy(buf, src + i, m) < 0){
+      ilock(ip);
+      return -1;
+    }
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(buf[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
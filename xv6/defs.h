@@ -1,18 +1,35 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
+struct idestat;
 struct inode;
+struct iostat;
+struct kmem_cache;
+struct kmemstat;
+struct pcachestat;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct schedstat;
+struct lockstat;
+struct slabstat;
 struct spinlock;
 struct sleeplock;
+struct rwsleeplock;
+struct rwlock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
+void            basyncdone(struct buf*);
+void            bcachestat(struct bcachestat*);
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     breaddata(uint, uint);
+void            breadahead(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -26,6 +43,10 @@ void            panic(char*) __attribute__((noreturn));
 int             exec(char*, char**);
 
 // file.c
+int             fdalloc(struct file*);
+int             fdclose(int);
+void            fdcopy(struct file**);
+struct file*    fdget(int);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
@@ -42,14 +63,17 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,6 +81,16 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idestat(struct idestat*);
+int             setidedma(int);
+
+// iosched.c
+struct buf*     iodequeue(int);
+void            iodone(struct buf*);
+void            ioqueue(struct buf*);
+void            ioschedinit(void);
+void            iostat(struct iostat*);
+int             setiosched(char*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -64,10 +98,19 @@ extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+char*           alloc_pages(int);
+void            free_pages(char*, int);
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
 void            kfree(char*);
+void            kincref(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemstat(struct kmemstat*);
+int             kfreepages(void);
+int             krefcount(char*);
+int             kzeroidle(void);
+void            register_shrinker(int (*)(int));
 
 // kbd.c
 void            kbdintr(void);
@@ -77,6 +120,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -95,9 +139,26 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+void            pcachestat(struct pcachestat*);
+void            pcdrop(struct inode*);
+char*           pclook(struct inode*, uint);
+char*           pcget(struct inode*, uint);
+void            pcwrite(struct inode*, char*, uint, uint);
+
+// pci.c
+void            pcienable(struct pcidev*);
+struct pcidev*  pcifind(ushort, ushort);
+struct pcidev*  pcifindclass(uchar, uchar);
+void            pciinit(void);
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -113,12 +174,24 @@ struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
+void            schedstat(struct schedstat*);
+int             schedtick(void);
+void            schedboost(void);
+int             setpriority(int, int);
+int             clone(uint, uint, uint);
+int             join(uint*);
+void            vmlock(struct proc*);
+void            vmunlock(struct proc*);
+void            tlbflush(pde_t*);
+void            tlbintr(void);
+int             getpriority(int);
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeup_one(void*);
 void            yield(void);
 
 // swtch.S
@@ -126,18 +199,45 @@ void            swtch(struct context**, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+void            acquirerd(struct rwlock*);
+void            acquirewr(struct rwlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
+int             holdingwr(struct rwlock*);
 void            initlock(struct spinlock*, char*);
+void            initrwlock(struct rwlock*, char*);
+int             lockstat(struct lockstat*, int);
 void            release(struct spinlock*);
+void            releaserd(struct rwlock*);
+void            releasewr(struct rwlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void*           kmem_cache_alloc(struct kmem_cache*);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabinit(void);
+int             slabstat(struct slabstat*, int);
+
+// sem.c
+void            seminit(void);
+int             semcreate(int);
+int             semwait(int);
+int             sempost(int);
+int             semclose(int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            acquirerdsleep(struct rwsleeplock*);
+void            releaserdsleep(struct rwsleeplock*);
+void            acquirewrsleep(struct rwsleeplock*);
+void            releasewrsleep(struct rwsleeplock*);
+int             holdingwrsleep(struct rwsleeplock*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -151,17 +251,24 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argptrw(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchmem(void*, uint, uint);
+int             fetchstr(uint, char*, int);
+int             storemem(uint, void*, uint);
 void            syscall(void);
 
+// ucopy.S
+int             umemcpy(void*, const void*, uint);
+
 // timer.c
 void            timerinit(void);
 
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern int      diskirq;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -179,12 +286,15 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
-int             copyout(pde_t*, uint, void*, uint);
+int             copyout(pde_t*, uint, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             pagefault(struct proc*, uint, int);
+void            vmaclear(pde_t*, struct vma*);
+int             vmamap(struct proc*, uint, uint, int, struct inode*, uint);
+int             vmaunmap(struct proc*, uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -0,0 +1,87 @@
+// Compare the CPU cost of moving disk data by PIO and by DMA.
+//   dmabench [rounds]
+// In each mode the disk driver offers, writes a file of the
+// largest size and reads it back, rounds times, and prints the
+// time taken, the blocks the disk moved, the interrupts, and
+// the CPU cycles the driver spent per megabyte. Run it on the
+// IDE and virtio kernels to compare the two. Build with
+// BUFMEM=0 (see the Makefile).
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+char buf[BSIZE];
+
+void
+pass(void)
+{
+  int fd, i;
+
+  if((fd = open("dmab", O_CREATE|O_RDWR)) < 0){
+    printf(2, "dmabench: cannot create dmab\n");
+    exit();
+  }
+  for(i = 0; i < MAXFILE; i++)
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      break;
+  close(fd);
+  if((fd = open("dmab", O_RDONLY)) < 0){
+    printf(2, "dmabench: cannot open dmab\n");
+    exit();
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  unlink("dmab");
+}
+
+void
+run(int dma, int rounds)
+{
+  struct idestat st0, st1;
+  uint blocks, kcycles, mb;
+  int i, t0;
+
+  if(setidedma(dma) < 0){
+    printf(1, "%s: not available\n", dma ? "dma" : "pio");
+    return;
+  }
+  idestat(&st0);
+  t0 = uptime();
+  for(i = 0; i < rounds; i++)
+    pass();
+  t0 = uptime() - t0;
+  idestat(&st1);
+
+  blocks = st1.mode[dma].blocks - st0.mode[dma].blocks;
+  kcycles = st1.mode[dma].kcycles - st0.mode[dma].kcycles;
+  mb = 1024*1024/BSIZE;
+  printf(1, "%s %s: %d ticks, %d blocks in %d commands, %d interrupts, "
+         "%d Kcycles per MB\n", st1.driver, dma ? "dma" : "pio", t0, blocks,
+         st1.mode[dma].cmds - st0.mode[dma].cmds,
+         st1.mode[dma].intrs - st0.mode[dma].intrs,
+         blocks == 0 ? 0 : blocks >= mb ? kcycles / (blocks / mb) :
+         kcycles * mb / blocks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct idestat st;
+  int rounds;
+
+  rounds = 3;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  idestat(&st);
+  run(0, rounds);
+  run(1, rounds);
+  setidedma(st.dma);
+  exit();
+}
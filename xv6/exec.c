@@ -16,9 +16,15 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
+  // Other threads would be left running the old program.
+  if(curproc->leader != curproc || curproc->nthreads > 0)
+    return -1;
+
+  memset(vma, 0, sizeof(vma));
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -26,7 +32,7 @@ exec(char *path, char **argv)
     cprintf("exec: fail\n");
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
   pgdir = 0;
 
   // Check ELF header
@@ -38,25 +44,40 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments. Nothing is read yet:
+  // pagefault() brings pages in from the page cache as the
+  // program touches them, so segments must start at the same
+  // offset within a page in the file as in memory.
   sz = 0;
+  v = vma;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
-    if(ph.type != ELF_PROG_LOAD)
+    if(ph.type != ELF_PROG_LOAD || ph.memsz == 0)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MMAPBASE)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr % PGSIZE != ph.off % PGSIZE || PGROUNDDOWN(ph.vaddr) < sz)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(v == &vma[NVMA])
       goto bad;
+    v->start = PGROUNDDOWN(ph.vaddr);
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->zero = v->end;
+    if(ph.memsz > ph.filesz)
+      v->zero = ph.vaddr + ph.filesz;
+    v->off = ph.off - (ph.vaddr - v->start);
+    v->flags = 0;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      v->flags |= VMA_WRITE;
+    v->ip = idup(ip);
+    sz = v->end;
+    v++;
   }
-  iunlockput(ip);
+  iunlockshared(ip);
+  iput(ip);
   end_op();
   ip = 0;
 
@@ -73,7 +94,7 @@ exec(char *path, char **argv)
     if(argc >= MAXARG)
       goto bad;
     sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
+    if(copyout(pgdir, sz, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
       goto bad;
     ustack[3+argc] = sp;
   }
@@ -84,7 +105,7 @@ exec(char *path, char **argv)
   ustack[2] = sp - (argc+1)*4;  // argv pointer
 
   sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
+  if(copyout(pgdir, sz, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
   // Save program name for debugging.
@@ -100,15 +121,19 @@ exec(char *path, char **argv)
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
+  vmaclear(oldpgdir, curproc->vma);
   freevm(oldpgdir);
+  memmove(curproc->vma, vma, sizeof(vma));
   return 0;
 
  bad:
   if(pgdir)
     freevm(pgdir);
   if(ip){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     end_op();
   }
+  vmaclear(0, vma);
   return -1;
 }
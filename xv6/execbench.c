@@ -0,0 +1,102 @@
+// Measure the cost of exec.
+//   execbench [nsh]
+// Times fork+exec of a small program, then starts nsh copies
+// of sh (30 by default), each waiting for input, and reports
+// how much memory they take between them.
+
+#include "types.h"
+#include "param.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define N 100
+
+int
+nfree(void)
+{
+  struct kmemstat st;
+
+  kmemstat(&st);
+  return st.nfree;
+}
+
+void
+latency(void)
+{
+  char *argv[] = { "execbench", "-x", 0 };
+  int i, pid, t0, t1;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "execbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec("execbench", argv);
+      printf(2, "execbench: exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "fork+exec: %d ticks for %d runs\n", t1 - t0, N);
+}
+
+void
+shells(int nsh)
+{
+  char *argv[] = { "sh", 0 };
+  int in[2], out[2], i, pid, before, used;
+  char c;
+
+  if(pipe(in) < 0 || pipe(out) < 0){
+    printf(2, "execbench: pipe failed\n");
+    exit();
+  }
+  before = nfree();
+  for(i = 0; i < nsh; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "execbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      // Read commands from in; prompts go to out.
+      close(0);
+      dup(in[0]);
+      close(2);
+      dup(out[1]);
+      close(in[0]);
+      close(in[1]);
+      close(out[0]);
+      close(out[1]);
+      exec("sh", argv);
+      exit();
+    }
+    // Wait for the prompt, so the shell is up and running.
+    read(out[0], &c, 1);
+    read(out[0], &c, 1);
+  }
+  used = before - nfree();
+  printf(1, "%d sh: %d pages (%d KB), %d KB each\n", i, used, used*4,
+         used*4/(i > 0 ? i : 1));
+  close(in[1]);
+  for(; i > 0; i--)
+    wait();
+  close(in[0]);
+  close(out[0]);
+  close(out[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit();
+  latency();
+  shells(argc > 1 ? atoi(argv[1]) : 30);
+  exit();
+}
@@ -5,6 +5,9 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -13,13 +16,14 @@
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +32,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +68,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -79,34 +79,163 @@ fileclose(struct file *f)
   }
 }
 
+// File descriptor tables. A process's threads share the table
+// of its leader, which outlives them: exit() in the leader joins
+// its threads before closing the files. ftable.lock protects the
+// tables as well as the reference counts.
+
+// Return the file open as descriptor fd in the current process,
+// with a reference for the caller to drop with fileclose(), or
+// 0. The reference keeps the file open if another thread closes
+// fd meanwhile.
+struct file*
+fdget(int fd)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&ftable.lock);
+  if((f = myproc()->leader->ofile[fd]) != 0)
+    f->ref++;
+  release(&ftable.lock);
+  return f;
+}
+
+// Allocate a file descriptor for the given file.
+// Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  struct file **ofile = myproc()->leader->ofile;
+  int fd;
+
+  acquire(&ftable.lock);
+  for(fd = 0; fd < NOFILE; fd++){
+    if(ofile[fd] == 0){
+      ofile[fd] = f;
+      release(&ftable.lock);
+      return fd;
+    }
+  }
+  release(&ftable.lock);
+  return -1;
+}
+
+// Close descriptor fd of the current process.
+int
+fdclose(int fd)
+{
+  struct file **ofile = myproc()->leader->ofile;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&ftable.lock);
+  if((f = ofile[fd]) != 0)
+    ofile[fd] = 0;
+  release(&ftable.lock);
+  if(f == 0)
+    return -1;
+  fileclose(f);
+  return 0;
+}
+
+// Fill ofile, the table of a new process, with the files open
+// in the current process.
+void
+fdcopy(struct file **ofile)
+{
+  struct file **from = myproc()->leader->ofile;
+  int fd;
+
+  acquire(&ftable.lock);
+  for(fd = 0; fd < NOFILE; fd++){
+    if((ofile[fd] = from[fd]) != 0)
+      ofile[fd]->ref++;
+  }
+  release(&ftable.lock);
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     return 0;
   }
   return -1;
 }
 
+// Read-ahead window, in blocks. It opens at RAMIN when reads
+// of a file look sequential and doubles with each further
+// sequential read, up to RAMAX; any other read closes it.
+#define RAMIN 4
+#define RAMAX 32
+
+// r bytes of f were just read at offset off. If the reads look
+// sequential, start reading the next blocks of the file.
+// Caller must hold f->ip->lock, which protects f->ra* as it
+// does f->off.
+static void
+fileahead(struct file *f, uint off, int r)
+{
+  uint bn, end;
+
+  if(off != f->ranext){
+    f->rawin = 0;
+    f->raend = 0;
+  } else if(f->rawin == 0)
+    f->rawin = RAMIN;
+  else if(f->rawin < RAMAX)
+    f->rawin *= 2;
+  f->ranext = off + r;
+  if(f->rawin == 0)
+    return;
+
+  bn = (f->ranext + BSIZE-1) / BSIZE;
+  end = bn + f->rawin;
+  if(bn < f->raend)
+    bn = f->raend;
+  if(bn < end){
+    ireadahead(f->ip, bn, end - bn);
+    f->raend = end;
+  }
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
+  int r, shared;
 
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    // Readers of a file can share its inode lock, unless they
+    // also share f->off, which the lock protects: f must have
+    // no references but the descriptor and the caller's, and
+    // no other thread may look the descriptor up. Device reads
+    // may unlock and relock the inode, so lock those exclusively.
+    shared = f->ref == 2 && myproc()->leader->nthreads == 0 &&
+             f->ip->type != T_DEV;
+    if(shared)
+      ilockshared(f->ip);
+    else
+      ilock(f->ip);
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      fileahead(f, f->off, r);
       f->off += r;
-    iunlock(f->ip);
+    }
+    if(shared)
+      iunlockshared(f->ip);
+    else
+      iunlock(f->ip);
     return r;
   }
   panic("fileread");
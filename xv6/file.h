@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint ranext;  // off at which the next read would be sequential
+  uint raend;   // first block not yet read ahead
+  uint rawin;   // read-ahead window, in blocks
 };
 
 
@@ -14,7 +17,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  struct inode *hnext; // icache hash chain
+  struct inode *next; // icache LRU list, while ref is zero
+  struct inode *prev;
+  struct rwsleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
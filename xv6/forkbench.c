@@ -0,0 +1,60 @@
+// Measure fork latency for a parent with a large address space.
+//   forkbench [megabytes]
+// Times fork+exit and fork+exec of a trivial program, the way
+// the shell runs commands, for a parent of the given size
+// (16 MB by default).
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N 50
+
+void
+run(char *what, int doexec)
+{
+  char *argv[] = { "forkbench", "-x", 0 };
+  int i, pid, t0, t1;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(doexec)
+        exec("forkbench", argv);
+      exit();
+    }
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "%s: %d ticks for %d runs\n", what, t1 - t0, N);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb;
+  uint i, sz;
+  char *p;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit();
+  mb = 16;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  sz = mb * 1024 * 1024;
+  if((p = sbrk(sz)) == (char*)-1){
+    printf(2, "forkbench: sbrk %d MB failed\n", mb);
+    exit();
+  }
+  for(i = 0; i < sz; i += 4096)
+    p[i] = i;
+  printf(1, "forkbench: %d MB parent\n", mb);
+  run("fork+exit", 0);
+  run("fork+exec", 1);
+  exit();
+}
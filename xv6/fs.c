@@ -119,18 +119,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref has fallen to zero stays cached,
+//   on a least-recently-used list, until iget() needs it
+//   for another inode or memory runs short (ishrink()).
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,28 +156,42 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold icache.lock
+// while using any of those fields. Entries are allocated from a
+// slab cache by iget(), found through a hash table on (dev, inum),
+// and kept on icache.lru while ip->ref is zero.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// ip->lock is a reader-writer lock: ilock() takes it exclusively,
+// for changing the inode or its contents, and ilockshared() lets
+// any number of processes read the inode and its contents
+// (readi, dirlookup, stati) at once.  Path lookup takes each
+// directory shared, so lookups through a common directory
+// such as "/" do not wait for each other.
+
+#define NIHASH 31
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];
+  struct inode lru;     // unreferenced entries, most recently used first
+  struct inode *free;   // entries given back by ishrink()
 } icache;
 
+static int ishrink(int n);
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
+  icache.lru.next = icache.lru.prev = &icache.lru;
+  register_shrinker(ishrink);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -235,37 +250,101 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Find the cached entry for inode inum on device dev, take a
+// reference to it, and return it, or 0.
+// Caller must hold icache.lock.
+static struct inode*
+icached(uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        ip->prev->next = ip->next;
+        ip->next->prev = ip->prev;
+      }
+      return ip;
+    }
+  }
+  return 0;
+}
+
+// Take ip out of its hash chain. Caller must hold icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+}
+
+// Take the unreferenced entry ip off the LRU list and out of
+// the cache. Caller must hold icache.lock.
+static void
+iforget(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+  iunhash(ip);
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *nip, **hp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  if((ip = icached(dev, inum)) != 0){
+    release(&icache.lock);
+    return ip;
+  }
+
+  // Allocate a new cache entry: one that ishrink() gave back,
+  // a new one, or else the least recently used idle one.
+  if((ip = icache.free) != 0)
+    icache.free = ip->hnext;
+  else {
+    // Not holding icache.lock, as kalloc() may call ishrink().
+    release(&icache.lock);
+    if((ip = kmem_cache_alloc(icache.cache)) != 0)
+      initrwsleeplock(&ip->lock, "inode");
+    acquire(&icache.lock);
+    // Another process may have cached the inode meanwhile.
+    if((nip = icached(dev, inum)) != 0){
+      if(ip){
+        ip->hnext = icache.free;
+        icache.free = ip;
+      }
       release(&icache.lock);
-      return ip;
+      return nip;
+    }
+    if(ip == 0){
+      if((ip = icache.lru.prev) == &icache.lru)
+        panic("iget: no inodes");
+      iforget(ip);
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
-
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  hp = ihash(dev, inum);
+  ip->hnext = *hp;
+  *hp = ip;
   release(&icache.lock);
 
   return ip;
@@ -293,7 +372,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewrsleep(&ip->lock);
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -311,19 +390,50 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode for reading only; other readers
+// may hold it at the same time.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquirerdsleep(&ip->lock);
+
+  // Only an exclusive holder may fill in the inode. It cannot
+  // become invalid again while the caller holds a reference.
+  if(ip->valid == 0){
+    releaserdsleep(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquirerdsleep(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingwrsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasewrsleep(&ip->lock);
+}
+
+// Unlock an inode locked with ilockshared().
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releaserdsleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry goes
+// on the LRU list, or is freed if the inode is not valid.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,7 +441,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquiresleep(&ip->lock);
+  struct inode *free, *next;
+
+  acquirewrsleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
     int r = ip->ref;
@@ -344,11 +456,58 @@ iput(struct inode *ip)
       ip->valid = 0;
     }
   }
-  releasesleep(&ip->lock);
+  releasewrsleep(&ip->lock);
+
+  acquire(&icache.lock);
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  if(ip->valid){
+    // Keep it for the next iget(), most recently used first.
+    ip->next = icache.lru.next;
+    ip->prev = &icache.lru;
+    icache.lru.next->prev = ip;
+    icache.lru.next = ip;
+    ip = 0;
+  } else
+    iunhash(ip);
+  // Give entries that ishrink() dropped back to the slab too.
+  free = icache.free;
+  icache.free = 0;
+  release(&icache.lock);
+  if(ip)
+    kmem_cache_free(icache.cache, ip);
+  for(; free; free = next){
+    next = free->hnext;
+    kmem_cache_free(icache.cache, free);
+  }
+}
+
+// Called by kalloc() when memory is short: drop the least
+// recently used unreferenced inodes, enough to fill n slab
+// pages.
+//
+// kalloc() may be called with a slab cache locked, so the
+// entries go on icache.free rather than back to the slab;
+// iget() reuses them and the next iput() frees them. No pages
+// are freed here, so this returns 0.
+static int
+ishrink(int n)
+{
+  struct inode *ip;
+  int i;
 
   acquire(&icache.lock);
-  ip->ref--;
+  for(i = 0; i < n * (PGSIZE / sizeof(struct inode)); i++){
+    if((ip = icache.lru.prev) == &icache.lru)
+      break;
+    iforget(ip);
+    ip->hnext = icache.free;
+    icache.free = ip;
+  }
   release(&icache.lock);
+  return 0;
 }
 
 // Common idiom: unlock, then put.
@@ -430,12 +589,13 @@ itrunc(struct inode *ip)
     ip->addrs[NDIRECT] = 0;
   }
 
+  pcdrop(ip);
   ip->size = 0;
   iupdate(ip);
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -446,14 +606,27 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read block bn of ip's contents. The buffer cache keeps
+// directory blocks as metadata, and other files' blocks as data.
+static struct buf*
+ibread(struct inode *ip, uint bn)
+{
+  if(ip->type == T_DIR)
+    return bread(ip->dev, bmap(ip, bn));
+  return breaddata(ip->dev, bmap(ip, bn));
+}
+
 //PAGEBREAK!
 // Read data from inode.
-// Caller must hold ip->lock.
+// dst may be a user address: returns -1 if it is not mapped.
+// Caller must hold ip->lock, shared or exclusive.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *pg;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -467,22 +640,52 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+    // The page cache is newer than the disk if a shared
+    // mapping has written to the page.
+    if((pg = pclook(ip, off/PGSIZE)) != 0){
+      r = umemcpy(dst, pg + off%PGSIZE, m);
+      kfree(pg);
+    } else {
+      bp = ibread(ip, off/BSIZE);
+      r = umemcpy(dst, bp->data + off%BSIZE, m);
+      brelse(bp);
+    }
+    if(r < 0)
+      return -1;
   }
   return n;
 }
 
+// Start reading blocks bn through bn+n-1 of ip into the
+// buffer cache, stopping at the end of the file, without
+// waiting for the disk.
+// Caller must hold ip->lock, shared or exclusive.
+void
+ireadahead(struct inode *ip, uint bn, uint n)
+{
+  uint end;
+
+  if(ip->type == T_DEV)
+    return;
+  end = (ip->size + BSIZE-1) / BSIZE;
+  if(bn + n < end)
+    end = bn + n;
+  for(; bn < end; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+}
+
 // PAGEBREAK!
 // Write data to inode.
-// Caller must hold ip->lock.
+// src may be a user address: returns -1 if it is not mapped,
+// having written what came before the fault.
+// Caller must hold ip->lock exclusively.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -496,18 +699,21 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = ibread(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+    r = umemcpy(bp->data + off%BSIZE, src, m);
+    pcwrite(ip, (char*)bp->data + off%BSIZE, off, m);
     log_write(bp);
     brelse(bp);
+    if(r < 0)
+      break;
   }
 
   if(n > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot < n ? -1 : n;
 }
 
 //PAGEBREAK!
@@ -521,6 +727,7 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared or exclusive.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -548,6 +755,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Caller must hold dp->lock exclusively.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
@@ -632,21 +840,22 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -1,4 +1,7 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Moves data by bus-master DMA when
+// the controller is a PCI IDE controller that can do it, else
+// by PIO. DMA commands take one interrupt however many blocks
+// they move, straight to and from the bufs' data.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +15,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "kstat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +28,55 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus-master registers of the primary channel, from the
+// controller's BAR4. See the PCI IDE Bus Master spec.
+#define BM_CMD        0
+#define BM_START      0x01  // start the transfer
+#define BM_READ       0x08  // transfer to memory (disk read)
+#define BM_STATUS     2
+#define BM_ERR        0x02  // write 1 to clear
+#define BM_INTR       0x04  // write 1 to clear
+#define BM_PRDT       4     // physical address of the PRD table
+
+// Physical region descriptor: one contiguous piece of memory
+// of a DMA transfer. A region must not cross a 64K boundary.
+struct prd {
+  uint addr;
+  ushort count;   // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last region of the transfer
+
+#define IDEMAXMERGE  16  // most blocks in one disk command
+
+// idebusy points to the bufs of the command now on the disk,
+// linked through qnext; the first is being read/written.
+// Requests waiting for the disk are queued by iosched.c.
+// You must hold idelock while manipulating either.
 
 static struct spinlock idelock;
-static struct buf *idequeue;
+static struct buf *idebusy;
+static int busydma;        // idebusy's command uses DMA
 
 static int havedisk1;
-static void idestart(struct buf*);
+static ushort bmbase;      // bus-master registers; 0 if no DMA
+static int usedma;         // start new commands with DMA
+
+// DMA regions of the command; aligned to its size, so that
+// it cannot cross a 64K boundary itself.
+static struct prd prdt[IDEMAXMERGE]
+  __attribute__((aligned(IDEMAXMERGE*sizeof(struct prd))));
+
+// Counters for idestat(), by mode: [0] PIO, [1] DMA.
+static struct {
+  uint cmds;
+  uint blocks;
+  uint intrs;
+  uint64 cycles;   // spent starting commands and in ideintr()
+} modestat[2];
 
 // Wait for IDE disk to become ready.
 static int
@@ -50,6 +94,7 @@ idewait(int checkerr)
 void
 ideinit(void)
 {
+  struct pcidev *d;
   int i;
 
   initlock(&idelock, "ide");
@@ -67,16 +112,75 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // DMA needs a PCI IDE controller with its bus-master
+  // registers in I/O space. Assumes the drives accept DMA
+  // commands, as QEMU's do.
+  if((d = pcifindclass(0x01, 0x01)) != 0 && (d->bar[4] & PCI_BARIO) &&
+     (d->bar[4] & ~3) != 0){
+    pcienable(d);
+    bmbase = d->bar[4] & ~3;
+    usedma = 1;
+  }
+}
+
+// Use DMA for new commands if on, else PIO.
+// Returns -1 if the controller cannot do DMA.
+int
+setidedma(int on)
+{
+  if(on && bmbase == 0)
+    return -1;
+  acquire(&idelock);
+  usedma = on != 0;
+  release(&idelock);
+  return 0;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Copy the counters out for the idestat system call.
+void
+idestat(struct idestat *st)
+{
+  int i;
+
+  acquire(&idelock);
+  safestrcpy(st->driver, "ide", sizeof(st->driver));
+  st->dma = usedma;
+  st->candma = bmbase != 0;
+  st->maxbusy = 1;
+  for(i = 0; i < 2; i++){
+    st->mode[i].cmds = modestat[i].cmds;
+    st->mode[i].blocks = modestat[i].blocks;
+    st->mode[i].intrs = modestat[i].intrs;
+    st->mode[i].kcycles = modestat[i].cycles >> 10;
+  }
+  release(&idelock);
+}
+
+// Start the command for b and the bufs linked to it, which
+// are for the blocks that follow.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *m;
+  uint64 t0;
+  int n;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
+  t0 = rdtsc();
+  busydma = usedma;
+  n = 0;
+  for(m = b; m; m = m->qnext){
+    if(m->blockno >= FSSIZE)
+      panic("incorrect blockno");
+    if(busydma){
+      prdt[n].addr = V2P(m->data);
+      prdt[n].count = BSIZE;
+      prdt[n].flags = m->qnext ? 0 : PRD_EOT;
+    }
+    n++;
+  }
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
@@ -85,18 +189,62 @@ idestart(struct buf *b)
   if (sector_per_block > 7) panic("idestart");
 
   idewait(0);
+  if(busydma){
+    outb(bmbase + BM_CMD, 0);
+    outl(bmbase + BM_PRDT, V2P(prdt));
+    outb(bmbase + BM_STATUS, BM_ERR|BM_INTR);
+    outb(bmbase + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    read_cmd = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+  }
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(busydma){
+    outb(0x1f7, (b->flags & B_DIRTY) ? write_cmd : read_cmd);
+    outb(bmbase + BM_CMD, inb(bmbase + BM_CMD) | BM_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
+
+  modestat[busydma].cmds++;
+  modestat[busydma].blocks += n;
+  modestat[busydma].cycles += rdtsc() - t0;
+}
+
+// Start the next command, if any.  Caller must hold idelock.
+static void
+idenext(void)
+{
+  // A PIO command interrupts once per sector, which is once
+  // per buf only if blocks are one sector.
+  idebusy = iodequeue(usedma || BSIZE == SECTOR_SIZE ? IDEMAXMERGE : 1);
+  if(idebusy != 0)
+    idestart(idebusy);
+}
+
+// The disk is done with b.  Caller must hold idelock.
+static void
+idedone(struct buf *b)
+{
+  iodone(b);
+
+  // Wake process waiting for this buf.
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  wakeup(b);
+
+  // No one is waiting for a read-ahead; release it.
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    basyncdone(b);
+  }
 }
 
 // Interrupt handler.
@@ -104,28 +252,51 @@ void
 ideintr(void)
 {
   struct buf *b;
+  uint64 t0;
+  int err, dma;
 
-  // First queued buffer is the active request.
+  // First buf of the command is the one the disk is done with,
+  // or with DMA, all of them are.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = idebusy) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  t0 = rdtsc();
+  dma = busydma;
+  idebusy = b->qnext;
+
+  err = idewait(1) < 0;
+  if(dma){
+    outb(bmbase + BM_CMD, 0);
+    if(inb(bmbase + BM_STATUS) & BM_ERR)
+      err = 1;
+    outb(bmbase + BM_STATUS, BM_ERR|BM_INTR);
+  }
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  if(!(b->flags & B_DIRTY) && !err && !dma)
     insl(0x1f0, b->data, BSIZE/4);
+  idedone(b);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // DMA and errors end the command; the disk will not
+  // interrupt for the rest of its bufs.
+  while((dma || err) && idebusy != 0){
+    b = idebusy;
+    idebusy = b->qnext;
+    idedone(b);
+  }
+
+  // Give the disk the next block of a write.
+  if(idebusy != 0 && (idebusy->flags & B_DIRTY))
+    outsl(0x1f0, idebusy->data, BSIZE/4);
+  modestat[dma].intrs++;
+  modestat[dma].cycles += rdtsc() - t0;
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on the next command.
+  if(idebusy == 0)
+    idenext();
 
   release(&idelock);
 }
@@ -134,11 +305,11 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return at once; ideintr() releases the
+// buf when the disk is done.
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,17 +319,18 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ioqueue(b);
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idebusy == 0)
+    idenext();
 
-  // Wait for request to finish.
+  // Wait for request to finish, unless ideintr() is
+  // to release b.
+  if(b->flags & B_ASYNC){
+    release(&idelock);
+    return;
+  }
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
@@ -0,0 +1,154 @@
+// Compare the disk request scheduling policies.
+//   iobench [rounds]
+// Makes NBIG files of the largest size, then for each policy
+// has NBIG processes read one file each, rounds times, while
+// another process writes and removes a small file, so that
+// the disk sees reads from several places at once and the
+// log's writes. Prints the time taken, the disk commands and
+// blocks of seek, and the median and worst-1% latency of reads
+// and writes. Build with BUFMEM=0 (see the Makefile).
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+#define NBIG 3
+
+char *policies[] = { "fifo", "clook", "deadline" };
+
+char buf[BSIZE];
+
+void
+name(char *s, int i)
+{
+  s[0] = 'i';
+  s[1] = 'o';
+  s[2] = 'b';
+  s[3] = '0' + i;
+  s[4] = 0;
+}
+
+void
+reader(int i, int rounds)
+{
+  char path[8];
+  int fd;
+
+  name(path, i);
+  while(rounds-- > 0){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf(2, "iobench: cannot open %s\n", path);
+      exit();
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  exit();
+}
+
+void
+writer(void)
+{
+  int fd, i;
+
+  for(;;){
+    if((fd = open("iobw", O_CREATE|O_RDWR)) < 0){
+      printf(2, "iobench: cannot create iobw\n");
+      exit();
+    }
+    for(i = 0; i < 4; i++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+    unlink("iobw");
+  }
+}
+
+// The bucket of h holding the p'th percentile, as a power of two.
+int
+percentile(uint *h, int p)
+{
+  uint n, sum;
+  int i;
+
+  n = 0;
+  for(i = 0; i < NIOHIST; i++)
+    n += h[i];
+  sum = 0;
+  for(i = 0; i < NIOHIST-1; i++){
+    sum += h[i];
+    if(sum * 100 >= n * p)
+      break;
+  }
+  return IOHISTBASE + i;
+}
+
+void
+run(char *policy, int rounds)
+{
+  struct iostat st;
+  int i, t0, wpid;
+
+  if(setiosched(policy) < 0){
+    printf(2, "iobench: no policy %s\n", policy);
+    return;
+  }
+  t0 = uptime();
+  if((wpid = fork()) == 0)
+    writer();
+  for(i = 0; i < NBIG; i++)
+    if(fork() == 0)
+      reader(i, rounds);
+  for(i = 0; i < NBIG; i++)
+    wait();
+  t0 = uptime() - t0;
+  kill(wpid);
+  wait();
+  iostat(&st);
+  unlink("iobw");
+
+  printf(1, "%s: %d ticks, %d reads %d writes in %d commands, "
+         "%d blocks seek\n", policy, t0, st.reqs[0], st.reqs[1],
+         st.cmds, st.seek);
+  printf(1, "%s: read latency 50%% <2^%d 99%% <2^%d cycles, "
+         "write 50%% <2^%d 99%% <2^%d\n", policy,
+         percentile(st.hist[0], 50), percentile(st.hist[0], 99),
+         percentile(st.hist[1], 50), percentile(st.hist[1], 99));
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[8];
+  int rounds, i, j, fd;
+
+  rounds = 2;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  for(i = 0; i < NBIG; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(2, "iobench: cannot create %s\n", path);
+      exit();
+    }
+    for(j = 0; j < MAXFILE; j++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+        break;
+    close(fd);
+  }
+
+  for(i = 0; i < sizeof(policies)/sizeof(policies[0]); i++)
+    run(policies[i], rounds);
+  setiosched("deadline");
+
+  for(i = 0; i < NBIG; i++){
+    name(path, i);
+    unlink(path);
+  }
+  exit();
+}
@@ -0,0 +1,240 @@
+// I/O scheduler: orders the disk driver's request queue.
+//
+// The driver hands each request (a locked buf) to ioqueue()
+// and, whenever the disk falls idle, asks iodequeue() for the
+// next command to start. The current policy picks a request;
+// iodequeue() then merges into the same command any queued
+// requests for the blocks that follow it, in the same
+// direction, so that a run of adjacent blocks costs the disk
+// one command instead of one each. The bufs of a command come
+// back linked through qnext, in block order.
+//
+// Policies:
+// * fifo: in order of arrival.
+// * clook: C-LOOK elevator. The request with the lowest block
+//   number at or past the end of the last command; if there is
+//   none, the lowest block number of all. The head sweeps up
+//   the disk and then jumps back to the start.
+// * deadline: as clook, but a request that has waited past its
+//   deadline (READWAIT ticks for reads, WRITEWAIT for writes)
+//   goes first, so that a stream of nearby requests cannot
+//   starve a distant one. Reads get the shorter deadline since
+//   a process usually sleeps for them.
+//
+// The driver calls iodone() as each request completes, which
+// adds the time the request spent queued and on the disk to a
+// histogram, by powers of two of CPU cycles.
+//
+// The queue is kept in arrival order whatever the policy, so
+// the policy can be changed at any time (see setiosched()).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "kstat.h"
+
+#define READWAIT   5  // ticks a read may wait under deadline
+#define WRITEWAIT 50  // ticks a write may wait under deadline
+
+static struct buf *pickfifo(void);
+static struct buf *pickclook(void);
+static struct buf *pickdeadline(void);
+
+static struct iopolicy {
+  char *name;
+  struct buf *(*pick)(void);  // next request; the queue is not empty
+} policies[] = {
+  { "fifo", pickfifo },
+  { "clook", pickclook },
+  { "deadline", pickdeadline },
+};
+
+struct {
+  struct spinlock lock;
+  struct iopolicy *policy;
+  struct buf *head;     // queued requests, oldest first
+  struct buf *tail;
+  uint pos;             // block after the end of the last command
+  struct iostat st;
+} iosched;
+
+void
+ioschedinit(void)
+{
+  initlock(&iosched.lock, "iosched");
+  iosched.policy = &policies[NELEM(policies)-1];
+  safestrcpy(iosched.st.policy, iosched.policy->name,
+             sizeof(iosched.st.policy));
+}
+
+// Switch to the named policy and clear the counters.
+// Returns -1 if there is no such policy.
+int
+setiosched(char *name)
+{
+  struct iopolicy *p;
+
+  for(p = policies; p < &policies[NELEM(policies)]; p++){
+    if(strncmp(p->name, name, sizeof(iosched.st.policy)) == 0){
+      acquire(&iosched.lock);
+      iosched.policy = p;
+      memset(&iosched.st, 0, sizeof(iosched.st));
+      safestrcpy(iosched.st.policy, p->name, sizeof(iosched.st.policy));
+      release(&iosched.lock);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static struct buf*
+pickfifo(void)
+{
+  return iosched.head;
+}
+
+static struct buf*
+pickclook(void)
+{
+  struct buf *b, *next, *low;
+
+  next = low = 0;
+  for(b = iosched.head; b; b = b->qnext){
+    if(b->blockno >= iosched.pos &&
+       (next == 0 || b->blockno < next->blockno))
+      next = b;
+    if(low == 0 || b->blockno < low->blockno)
+      low = b;
+  }
+  return next ? next : low;
+}
+
+static struct buf*
+pickdeadline(void)
+{
+  struct buf *b, *late;
+
+  late = 0;
+  for(b = iosched.head; b; b = b->qnext)
+    if((int)(ticks - b->qdeadline) >= 0 &&
+       (late == 0 || (int)(b->qdeadline - late->qdeadline) < 0))
+      late = b;
+  if(late)
+    return late;
+  return pickclook();
+}
+
+// Take b off the queue.
+static void
+iounlink(struct buf *b)
+{
+  struct buf **pp, *prev;
+
+  prev = 0;
+  for(pp = &iosched.head; *pp != b; pp = &(*pp)->qnext)
+    prev = *pp;
+  *pp = b->qnext;
+  if(iosched.tail == b)
+    iosched.tail = prev;
+  b->qnext = 0;
+}
+
+// Find a queued request for block blockno of b's device,
+// going the same way as b.
+static struct buf*
+iofind(struct buf *b, uint blockno)
+{
+  struct buf *m;
+
+  for(m = iosched.head; m; m = m->qnext)
+    if(m->dev == b->dev && m->blockno == blockno &&
+       (m->flags & B_DIRTY) == (b->flags & B_DIRTY))
+      return m;
+  return 0;
+}
+
+// Queue a request for the disk.
+void
+ioqueue(struct buf *b)
+{
+  int w;
+
+  w = (b->flags & B_DIRTY) != 0;
+  b->qstart = (uint)rdtsc();
+  b->qdeadline = ticks + (w ? WRITEWAIT : READWAIT);
+  b->qnext = 0;
+  acquire(&iosched.lock);
+  if(iosched.tail)
+    iosched.tail->qnext = b;
+  else
+    iosched.head = b;
+  iosched.tail = b;
+  iosched.st.reqs[w]++;
+  release(&iosched.lock);
+}
+
+// Choose the next command for the disk: a request and up to
+// max-1 more for the blocks that follow it, linked through
+// qnext. Returns 0 if nothing is queued.
+struct buf*
+iodequeue(int max)
+{
+  struct buf *b, *last, *m;
+  int n;
+
+  acquire(&iosched.lock);
+  if(iosched.head == 0){
+    release(&iosched.lock);
+    return 0;
+  }
+  b = iosched.policy->pick();
+  iounlink(b);
+  last = b;
+  for(n = 1; n < max; n++){
+    if((m = iofind(b, last->blockno + 1)) == 0)
+      break;
+    iounlink(m);
+    last->qnext = m;
+    last = m;
+    iosched.st.merged++;
+  }
+  if(b->blockno >= iosched.pos)
+    iosched.st.seek += b->blockno - iosched.pos;
+  else
+    iosched.st.seek += iosched.pos - b->blockno;
+  iosched.pos = last->blockno + 1;
+  iosched.st.cmds++;
+  release(&iosched.lock);
+  return b;
+}
+
+// The disk has finished b's request. Call before clearing
+// B_DIRTY.
+void
+iodone(struct buf *b)
+{
+  uint t;
+  int i, w;
+
+  w = (b->flags & B_DIRTY) != 0;
+  t = (uint)rdtsc() - b->qstart;
+  for(i = 0; i < NIOHIST-1 && t >= (1 << (i+IOHISTBASE)); i++)
+    ;
+  acquire(&iosched.lock);
+  iosched.st.hist[w][i]++;
+  release(&iosched.lock);
+}
+
+// Copy the counters out for the iostat system call.
+void
+iostat(struct iostat *st)
+{
+  acquire(&iosched.lock);
+  *st = iosched.st;
+  release(&iosched.lock);
+}
@@ -1,26 +1,92 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and physically
+// contiguous blocks of 2^order pages.
+//
+// Free memory is kept by a binary buddy allocator: a block of
+// 2^k pages is aligned to its size, and its buddy is the block
+// whose address differs only in bit k of the page number. Freeing
+// a block whose buddy is also free merges the two into a block of
+// order k+1.
+//
+// Single pages normally come from a small per-CPU cache so that
+// the common kalloc()/kfree() path touches only that CPU's
+// lock. Caches are refilled from, and drained to, the buddy
+// allocator in batches. A CPU whose cache and the buddy
+// allocator are both empty steals half of another CPU's cache.
+//
+// Each CPU also keeps a list of pages that are already zero.
+// The scheduler fills it while the CPU is idle (kzeroidle), and
+// kalloc_zeroed() takes from it so that page tables and fresh
+// user pages are not zeroed on the allocation path.
+//
+// A single page handed out by kalloc() carries a reference
+// count so that copy-on-write fork can share it between
+// address spaces; kfree() only frees it when the last
+// reference goes away.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "kstat.h"
+
+#define KCACHEMAX   64  // drain a CPU's cache when it grows past this
+#define KCACHEBATCH 16  // pages moved per refill or drain
+#define KZEROMAX    32  // pre-zeroed pages kept per CPU
+#define KZEROMIN   256  // don't pre-zero when fewer pages are free
+#define NSHRINKER     4  // caches that can give memory back
 
 void freerange(void *vstart, void *vend);
+static void buddyfree(char *v, int order);
+static int kderef(char *v);
+static struct run *kzerotake(int self);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;  // only used on the buddy lists
+};
+
+#define NPAGE (PHYSTOP/PGSIZE)
+
+// Per physical page state, indexed by physical page number.
+// free and order are only meaningful for the first page of
+// a free buddy block, ref only for a page from kalloc().
+struct page {
+  uchar free;   // first page of a block on a buddy list?
+  uchar order;  // order of that block
+  ushort ref;   // references to an allocated page
 };
 
+// Per-CPU page cache. The lock is only contended when
+// another CPU steals from this cache.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  uint hits;     // kalloc() satisfied from this cache
+  uint refills;  // batches taken from the buddy allocator
+  uint drains;   // batches returned to the buddy allocator
+  uint steals;   // pages taken from other CPUs' caches
+  struct run *zerolist;  // pages known to be all zero
+  int nzero;
+  uint zhits;    // kalloc_zeroed() served from zerolist
+  uint zmisses;  // kalloc_zeroed() that had to zero a page
+} __attribute__((__aligned__(64)));
+
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run area[MAXORDER+1];  // circular lists of free blocks by order
+  uint nblock[MAXORDER+1];      // number of blocks on each list
+  int nfree;                    // pages on the buddy lists
+  struct page page[NPAGE];
+  struct kcache cpu[NCPU];
 } kmem;
 
 // Initialization happens in two phases.
@@ -28,10 +94,19 @@ struct {
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until kinit2() turns on locking, all pages go straight to the
+// buddy allocator and the per-CPU caches are bypassed (cpuid() is not
+// usable before mpinit()).
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i <= MAXORDER; i++)
+    kmem.area[i].next = kmem.area[i].prev = &kmem.area[i];
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -43,14 +118,172 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Free [vstart, vend) at boot, in the largest aligned blocks
+// that fit. The pages have never been handed out, so there is
+// no point filling them with junk.
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
+  int order;
+
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  if(p < end || V2P(vend) > PHYSTOP)
+    panic("freerange");
+  while(p + PGSIZE <= (char*)vend){
+    for(order = MAXORDER; order > 0; order--)
+      if(V2P(p) % (PGSIZE << order) == 0 &&
+         p + (PGSIZE << order) <= (char*)vend)
+        break;
+    buddyfree(p, order);
+    p += PGSIZE << order;
+  }
+}
+
+//PAGEBREAK!
+// Buddy allocator. Caller must hold kmem.lock (once use_lock is set).
+
+static void
+buddypush(struct run *r, int order)
+{
+  struct run *h;
+  struct page *pg;
+
+  h = &kmem.area[order];
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kmem.nblock[order]++;
+  pg = &kmem.page[V2P(r)/PGSIZE];
+  pg->free = 1;
+  pg->order = order;
+}
+
+static void
+buddyremove(struct run *r, int order)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.nblock[order]--;
+  kmem.page[V2P(r)/PGSIZE].free = 0;
+}
+
+// Return the block of 2^order pages at v to the free lists,
+// merging it with its buddy for as long as the buddy is free.
+static void
+buddyfree(char *v, int order)
+{
+  uint pa, bpa;
+  struct page *bp;
+
+  kmem.nfree += 1 << order;
+  pa = V2P(v);
+  for(; order < MAXORDER; order++){
+    bpa = pa ^ (PGSIZE << order);
+    if(bpa >= PHYSTOP)
+      break;
+    bp = &kmem.page[bpa/PGSIZE];
+    if(!bp->free || bp->order != order)
+      break;
+    buddyremove((struct run*)P2V(bpa), order);
+    if(bpa < pa)
+      pa = bpa;
+  }
+  buddypush((struct run*)P2V(pa), order);
+}
+
+// Take a block of 2^order pages off the free lists, splitting
+// a larger block if there is none of the right size.
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nblock[k] > 0)
+      break;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.area[k].next;
+  buddyremove(r, k);
+  // Give back the upper half until the block is the right size.
+  while(k > order){
+    k--;
+    buddypush((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  kmem.nfree -= 1 << order;
+  return (char*)r;
+}
+
+// Take up to n single pages from the buddy allocator.
+// Returns the chain and sets *got to its length.
+static struct run*
+kgetbatch(int n, int *got)
+{
+  struct run *r, *head;
+  int i;
+
+  head = 0;
+  acquire(&kmem.lock);
+  for(i = 0; i < n; i++){
+    if((r = (struct run*)buddyalloc(0)) == 0)
+      break;
+    r->next = head;
+    head = r;
+  }
+  release(&kmem.lock);
+  *got = i;
+  return head;
 }
+
+// Return a chain of single pages to the buddy allocator.
+static void
+kputbatch(struct run *r)
+{
+  struct run *next;
+
+  acquire(&kmem.lock);
+  for(; r; r = next){
+    next = r->next;
+    buddyfree((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take half of some other CPU's cache.
+static struct run*
+ksteal(int self, int *got)
+{
+  struct kcache *kc;
+  struct run *r, *head;
+  int i, n;
+
+  for(i = 0; i < ncpu; i++){
+    if(i == self)
+      continue;
+    kc = &kmem.cpu[i];
+    acquire(&kc->lock);
+    if(kc->nfree > 0){
+      n = (kc->nfree + 1) / 2;
+      head = r = kc->freelist;
+      while(--n > 0)
+        r = r->next;
+      kc->freelist = r->next;
+      r->next = 0;
+      n = (kc->nfree + 1) / 2;
+      kc->nfree -= n;
+      release(&kc->lock);
+      *got = n;
+      return head;
+    }
+    release(&kc->lock);
+  }
+  *got = 0;
+  return 0;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -59,21 +292,136 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  struct kcache *kc;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(kderef(v) > 0)
+    return;
 
+#ifndef NOJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  kc = &kmem.cpu[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  head = 0;
+  if(kc->nfree > KCACHEMAX){
+    // Hand a batch back to the buddy allocator.
+    head = tail = kc->freelist;
+    for(i = 1; i < KCACHEBATCH; i++)
+      tail = tail->next;
+    kc->freelist = tail->next;
+    tail->next = 0;
+    kc->nfree -= KCACHEBATCH;
+    kc->drains++;
+  }
+  release(&kc->lock);
+  if(head)
+    kputbatch(head);
+  popcli();
+}
+
+// Take one page from this CPU's cache, the buddy allocator,
+// or another CPU, in that order.
+static char*
+kget(void)
+{
+  struct run *r, *batch;
+  struct kcache *kc;
+  int id, n, stolen;
+
+  if(!kmem.use_lock)
+    return buddyalloc(0);
+
+  pushcli();
+  id = cpuid();
+  kc = &kmem.cpu[id];
+  acquire(&kc->lock);
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+    kc->hits++;
+    release(&kc->lock);
+    popcli();
+    return (char*)r;
+  }
+  release(&kc->lock);
+
+  // Cache is empty: refill from the buddy allocator,
+  // or failing that, from another CPU.
+  stolen = 0;
+  if((batch = kgetbatch(KCACHEBATCH, &n)) == 0){
+    batch = ksteal(id, &n);
+    stolen = 1;
+  }
+  if(batch == 0){
+    // Last resort: pages that were set aside zeroed.
+    r = kzerotake(id);
+    popcli();
+    return (char*)r;
+  }
+  r = batch;
+  batch = batch->next;
+  acquire(&kc->lock);
+  if(batch){
+    r->next = batch;
+    while(batch->next)
+      batch = batch->next;
+    batch->next = kc->freelist;
+    kc->freelist = r->next;
+    kc->nfree += n - 1;
+  }
+  if(stolen)
+    kc->steals += n;
+  else
+    kc->refills++;
+  release(&kc->lock);
+  popcli();
+  return (char*)r;
+}
+
+// Functions that free pages held by other kernel caches,
+// called when kalloc() runs out. Each is asked for up to n
+// pages and returns how many it freed.
+static int (*shrinker[NSHRINKER])(int);
+
+void
+register_shrinker(int (*fn)(int))
+{
+  int i;
+
+  for(i = 0; i < NSHRINKER; i++){
+    if(shrinker[i] == 0){
+      shrinker[i] = fn;
+      return;
+    }
+  }
+  panic("register_shrinker");
+}
+
+static int
+kshrink(int n)
+{
+  int i, got;
+
+  got = 0;
+  for(i = 0; i < NSHRINKER && shrinker[i] && got < n; i++)
+    got += shrinker[i](n - got);
+  return got;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,15 +430,242 @@ kfree(char *v)
 char*
 kalloc(void)
 {
+  char *v;
+
+  if((v = kget()) == 0 && kshrink(KCACHEBATCH) > 0)
+    v = kget();
+  if(v != 0)
+    kmem.page[V2P(v)/PGSIZE].ref = 1;
+  return v;
+}
+
+//PAGEBREAK!
+// Reference counts. A page from kalloc() starts with one
+// reference; copy-on-write sharing adds more.
+
+// Add a reference to the page at v.
+void
+kincref(char *v)
+{
+  __sync_fetch_and_add(&kmem.page[V2P(v)/PGSIZE].ref, 1);
+}
+
+// Drop a reference to the page at v and return how many remain.
+static int
+kderef(char *v)
+{
+  struct page *pg;
+
+  pg = &kmem.page[V2P(v)/PGSIZE];
+  if(pg->ref == 0)
+    panic("kfree: ref");
+  return __sync_sub_and_fetch(&pg->ref, 1);
+}
+
+// Number of references to the page at v.
+int
+krefcount(char *v)
+{
+  return kmem.page[V2P(v)/PGSIZE].ref;
+}
+
+// Roughly how many pages are free, counting the per-CPU
+// caches. Read without locks.
+int
+kfreepages(void)
+{
+  int i, n;
+
+  n = kmem.nfree;
+  for(i = 0; i < ncpu; i++)
+    n += kmem.cpu[i].nfree + kmem.cpu[i].nzero;
+  return n;
+}
+
+// Allocate one zeroed page. Returns 0 if out of memory.
+char*
+kalloc_zeroed(void)
+{
+  struct kcache *kc;
+  struct run *r;
+  char *v;
+
+  if(kmem.use_lock){
+    pushcli();
+    kc = &kmem.cpu[cpuid()];
+    acquire(&kc->lock);
+    if((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      kc->nzero--;
+      kc->zhits++;
+    } else
+      kc->zmisses++;
+    release(&kc->lock);
+    popcli();
+    if(r){
+      r->next = 0;  // the only non-zero word
+      kmem.page[V2P(r)/PGSIZE].ref = 1;
+      return (char*)r;
+    }
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Called by scheduler() when this CPU has nothing to run:
+// zero one free page and put it on this CPU's zero list.
+// Returns 0 if there was no work to do.
+int
+kzeroidle(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  if(!kmem.use_lock)
+    return 0;
+  pushcli();
+  kc = &kmem.cpu[cpuid()];
+  popcli();  // the scheduler does not migrate between CPUs
+  if(kc->nzero >= KZEROMAX || kmem.nfree < KZEROMIN)
+    return 0;
+  if((r = (struct run*)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  acquire(&kc->lock);
+  r->next = kc->zerolist;
+  kc->zerolist = r;
+  kc->nzero++;
+  release(&kc->lock);
+  return 1;
+}
+
+// Take a page off any CPU's zero list, starting with self.
+static struct run*
+kzerotake(int self)
+{
+  struct kcache *kc;
+  struct run *r;
+  int i;
+
+  for(i = 0; i < ncpu; i++){
+    kc = &kmem.cpu[(self + i) % ncpu];
+    acquire(&kc->lock);
+    if((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      kc->nzero--;
+    }
+    release(&kc->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Give every CPU's cached pages back to the buddy allocator
+// so that they can merge into larger blocks.
+static void
+kdrainall(void)
+{
+  struct kcache *kc;
   struct run *r;
+  int i;
+
+  for(i = 0; i < ncpu; i++){
+    kc = &kmem.cpu[i];
+    acquire(&kc->lock);
+    r = kc->freelist;
+    kc->freelist = 0;
+    if(r)
+      kc->drains++;
+    kc->nfree = 0;
+    release(&kc->lock);
+    if(r)
+      kputbatch(r);
+  }
+}
+
+//PAGEBREAK!
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if no block that large is free.
+// kalloc() is the fast path for order 0.
+char*
+alloc_pages(int order)
+{
+  char *v;
+
+  if(order < 0 || order > MAXORDER)
+    panic("alloc_pages");
+  if(order == 0)
+    return kalloc();
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  v = buddyalloc(order);
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
+  if(v == 0 && kmem.use_lock){
+    // Pages parked in CPU caches may complete a block.
+    kdrainall();
+    acquire(&kmem.lock);
+    v = buddyalloc(order);
+    release(&kmem.lock);
+  }
+  return v;
 }
 
+// Free a block returned by alloc_pages(order).
+void
+free_pages(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER)
+    panic("free_pages");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if((uint)v % (PGSIZE << order) || v < end ||
+     V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("free_pages");
+
+#ifndef NOJUNK
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree(v, order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Copy allocator counters out for the kmemstat system call.
+void
+kmemstat(struct kmemstat *st)
+{
+  struct kcache *kc;
+  int i;
+
+  memset(st, 0, sizeof(*st));
+  acquire(&kmem.lock);
+  st->nfree = kmem.nfree;
+  for(i = 0; i <= MAXORDER; i++)
+    st->nblock[i] = kmem.nblock[i];
+  release(&kmem.lock);
+  st->ncpu = ncpu;
+  for(i = 0; i < ncpu; i++){
+    kc = &kmem.cpu[i];
+    acquire(&kc->lock);
+    st->cpu[i].nfree = kc->nfree;
+    st->cpu[i].hits = kc->hits;
+    st->cpu[i].refills = kc->refills;
+    st->cpu[i].drains = kc->drains;
+    st->cpu[i].steals = kc->steals;
+    st->cpu[i].nzero = kc->nzero;
+    st->cpu[i].zhits = kc->zhits;
+    st->cpu[i].zmisses = kc->zmisses;
+    release(&kc->lock);
+    st->nfree += kc->nfree + kc->nzero;
+  }
+}
@@ -0,0 +1,213 @@
+// Print kernel statistics.
+//   kstat          print everything
+//   kstat mem      physical page allocator
+//   kstat slab     slab caches
+//   kstat bcache   buffer cache
+//   kstat pcache   page cache
+//   kstat io       disk request scheduler
+//   kstat ide      disk driver
+//   kstat sched    scheduler run queues
+
+#include "types.h"
+#include "param.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "kstat.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+void
+memstat(void)
+{
+  struct kmemstat st;
+  int i;
+
+  if(kmemstat(&st) < 0){
+    printf(2, "kstat: kmemstat failed\n");
+    return;
+  }
+  printf(1, "kalloc: %d free pages\n", st.nfree);
+  printf(1, "buddy blocks by order:");
+  for(i = 0; i <= MAXORDER; i++)
+    printf(1, " %d", st.nblock[i]);
+  printf(1, "\n");
+  printf(1, "cpu\tfree\thits\trefills\tdrains\tsteals\tzero\tzhits\tzmisses\n");
+  for(i = 0; i < st.ncpu; i++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i, st.cpu[i].nfree,
+           st.cpu[i].hits, st.cpu[i].refills, st.cpu[i].drains,
+           st.cpu[i].steals, st.cpu[i].nzero, st.cpu[i].zhits,
+           st.cpu[i].zmisses);
+}
+
+void
+slabs(void)
+{
+  struct slabstat st[16];
+  int i, n;
+
+  if((n = slabstat(st, NELEM(st))) < 0){
+    printf(2, "kstat: slabstat failed\n");
+    return;
+  }
+  printf(1, "cache\tsize\tperslab\tslabs\tinuse\tcached\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%s\t%d\t%d\t%d\t%d\t%d\n", st[i].name, st[i].size,
+           st[i].perslab, st[i].nslab, st[i].inuse, st[i].cached);
+}
+
+// n as a percentage of total, without overflowing n*100.
+int
+percent(uint n, uint total)
+{
+  if(total == 0)
+    return 0;
+  if(total > 10000000)
+    return n / (total / 100);
+  return n * 100 / total;
+}
+
+// Cycles per megabyte, from cycles/1024 and blocks moved.
+int
+permb(uint kcycles, uint blocks)
+{
+  uint mb;
+
+  mb = 1024*1024/BSIZE;  // blocks per megabyte
+  if(blocks == 0)
+    return 0;
+  if(blocks >= mb)
+    return kcycles / (blocks / mb);
+  return kcycles * mb / blocks;
+}
+
+void
+bcache(void)
+{
+  struct bcachestat st;
+
+  if(bcachestat(&st) < 0){
+    printf(2, "kstat: bcachestat failed\n");
+    return;
+  }
+  printf(1, "bcache: %d buffers (at most %d), %d hits, %d misses, "
+         "%d evictions\n", st.nbuf, st.maxbuf, st.hits, st.misses,
+         st.evictions);
+  printf(1, "bcache: %d pages added, %d given back\n", st.grows,
+         st.shrinks);
+  printf(1, "bcache: %d blocks read ahead, %d used, %d wasted\n",
+         st.ahead, st.aheadused, st.aheadwasted);
+  printf(1, "bcache: metadata %d%% of %d hit, data %d%% of %d hit, "
+         "%d data blocks promoted\n",
+         percent(st.metahits, st.metahits + st.metamisses),
+         st.metahits + st.metamisses,
+         percent(st.datahits, st.datahits + st.datamisses),
+         st.datahits + st.datamisses, st.ghosthits);
+}
+
+void
+pcache(void)
+{
+  struct pcachestat st;
+
+  if(pcachestat(&st) < 0){
+    printf(2, "kstat: pcachestat failed\n");
+    return;
+  }
+  printf(1, "pcache: %d pages, %d hits, %d misses, %d reclaimed\n",
+         st.npage, st.hits, st.misses, st.reclaims);
+}
+
+void
+io(void)
+{
+  struct iostat st;
+  int i;
+
+  if(iostat(&st) < 0){
+    printf(2, "kstat: iostat failed\n");
+    return;
+  }
+  printf(1, "io: %s, %d reads, %d writes in %d commands, %d merged, "
+         "%d blocks seek\n", st.policy, st.reqs[0], st.reqs[1], st.cmds,
+         st.merged, st.seek);
+  printf(1, "cycles\treads\twrites\n");
+  for(i = 0; i < NIOHIST; i++)
+    printf(1, "%s2^%d\t%d\t%d\n", i == NIOHIST-1 ? ">=" : "<",
+           IOHISTBASE + i - (i == NIOHIST-1), st.hist[0][i], st.hist[1][i]);
+}
+
+void
+ide(void)
+{
+  struct idestat st;
+  char *name[] = { "pio", "dma" };
+  int i;
+
+  if(idestat(&st) < 0){
+    printf(2, "kstat: idestat failed\n");
+    return;
+  }
+  printf(1, "%s: using %s%s, at most %d commands at once\n", st.driver,
+         st.dma ? "dma" : "pio", st.candma ? "" : ", no dma", st.maxbusy);
+  for(i = 0; i < 2; i++)
+    printf(1, "%s: %s %d commands, %d blocks, %d interrupts, "
+           "%d Kcycles per MB\n", st.driver, name[i], st.mode[i].cmds,
+           st.mode[i].blocks, st.mode[i].intrs,
+           permb(st.mode[i].kcycles, st.mode[i].blocks));
+}
+
+void
+sched(void)
+{
+  struct schedstat st;
+  int i;
+
+  if(schedstat(&st) < 0){
+    printf(2, "kstat: schedstat failed\n");
+    return;
+  }
+  printf(1, "cpu\trunq\tswitch\tsteals\tmigrate\tticks\tbusy%%\n");
+  for(i = 0; i < st.ncpu; i++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i, st.cpu[i].nrun,
+           st.cpu[i].switches, st.cpu[i].steals, st.cpu[i].migrations,
+           st.cpu[i].ticks, st.cpu[i].ticks == 0 ? 0 :
+           100 - st.cpu[i].idleticks * 100 / st.cpu[i].ticks);
+}
+
+struct {
+  char *name;
+  void (*print)(void);
+} sections[] = {
+  { "mem", memstat },
+  { "slab", slabs },
+  { "bcache", bcache },
+  { "pcache", pcache },
+  { "io", io },
+  { "ide", ide },
+  { "sched", sched },
+};
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, found;
+
+  if(argc < 2){
+    for(i = 0; i < NELEM(sections); i++)
+      sections[i].print();
+    exit();
+  }
+  for(j = 1; j < argc; j++){
+    found = 0;
+    for(i = 0; i < NELEM(sections); i++){
+      if(strcmp(argv[j], sections[i].name) == 0){
+        sections[i].print();
+        found = 1;
+      }
+    }
+    if(!found)
+      printf(2, "kstat: unknown section %s\n", argv[j]);
+  }
+  exit();
+}
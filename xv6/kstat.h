@@ -0,0 +1,111 @@
+// Kernel statistics copied out to user space.
+// Both the kernel and user programs use this header file.
+
+// Physical page allocator (kalloc.c).
+struct kmemstat {
+  uint nfree;        // free pages, buddy lists plus CPU caches
+                     // and zero lists
+  uint nblock[MAXORDER+1];  // free buddy blocks of each order
+  uint ncpu;
+  struct {
+    uint nfree;      // pages in this CPU's cache
+    uint hits;       // kalloc()s served from the cache
+    uint refills;    // batches taken from the buddy allocator
+    uint drains;     // batches given back to the buddy allocator
+    uint steals;     // pages taken from other CPUs' caches
+    uint nzero;      // pre-zeroed pages on this CPU
+    uint zhits;      // kalloc_zeroed()s served pre-zeroed
+    uint zmisses;    // kalloc_zeroed()s that zeroed on the spot
+  } cpu[NCPU];
+};
+
+// Slab caches (slab.c).
+struct slabstat {
+  char name[16];
+  uint size;         // object size in bytes
+  uint perslab;      // objects per slab page
+  uint nslab;        // slab pages held
+  uint inuse;        // objects allocated
+  uint cached;       // free objects in CPU magazines
+};
+
+// Spin locks, by name (spinlock.c).
+struct lockstat {
+  char name[16];
+  uint acquires;
+  uint contended;    // acquires that had to wait
+  uint64 spin;       // cycles spent waiting
+  uint maxhold;      // longest time held, in cycles
+};
+
+// Scheduler run queues (proc.c).
+struct schedstat {
+  uint ncpu;
+  struct {
+    uint nrun;       // processes on the run queue
+    uint switches;   // processes run
+    uint steals;     // processes taken from other CPUs' queues
+    uint migrations; // processes that last ran on another CPU
+    uint ticks;      // clock ticks
+    uint idleticks;  // ... of which halted for lack of work
+  } cpu[NCPU];
+};
+
+// Buffer cache (bio.c).
+struct bcachestat {
+  uint nbuf;         // buffers in the cache
+  uint maxbuf;       // buffers the cache grows back to
+  uint hits;         // lookups that found the block cached
+  uint misses;       // lookups that had to recycle a buffer
+  uint evictions;    // ... whose buffer held another block
+  uint grows;        // pages of buffers added
+  uint shrinks;      // pages given back when memory was short
+  uint ahead;        // blocks read ahead
+  uint aheadused;    // ... that a later read used
+  uint aheadwasted;  // ... evicted without being used
+  uint metahits;     // bread()s of metadata found cached
+  uint metamisses;
+  uint datahits;     // breaddata()s of file data found cached
+  uint datamisses;
+  uint ghosthits;    // data blocks read again soon after eviction
+};
+
+// Page cache (pcache.c).
+struct pcachestat {
+  uint npage;        // pages cached
+  uint hits;         // lookups that found the page cached
+  uint misses;       // lookups that read the page from the file
+  uint reclaims;     // pages given back when memory was short
+};
+
+// I/O scheduler (iosched.c). hist[0] counts reads and hist[1]
+// writes by the cycles from queueing to completion: bucket i
+// holds those under 2^(IOHISTBASE+i) cycles, and the last
+// bucket everything slower.
+#define NIOHIST    16
+#define IOHISTBASE 14
+struct iostat {
+  char policy[16];   // see setiosched()
+  uint reqs[2];      // requests queued, reads and writes
+  uint cmds;         // disk commands started
+  uint merged;       // requests that joined another's command
+  uint seek;         // blocks between the end of one command
+                     // and the start of the next
+  uint hist[2][NIOHIST];
+};
+
+// Disk driver (ide.c, or virtio.c or memide.c in its place).
+// mode[0] counts PIO commands and mode[1] DMA ones.
+struct idestat {
+  char driver[8];    // "ide", "virtio" or "memide"
+  uint dma;          // 1 if new commands use DMA
+  uint candma;       // 1 if the controller can do DMA
+  uint maxbusy;      // most commands on the disk at once
+  struct {
+    uint cmds;       // disk commands
+    uint blocks;     // blocks moved
+    uint intrs;      // disk interrupts handled
+    uint kcycles;    // CPU cycles/1024 spent starting commands
+                     // and handling their interrupts
+  } mode[2];
+};
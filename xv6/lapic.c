@@ -105,6 +105,19 @@ lapicid(void)
   return lapic[ID] >> 24;
 }
 
+// Send interrupt vector to the CPU whose local APIC ID is
+// apicid. Caller must have interrupts disabled.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | DEASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Acknowledge interrupt.
 void
 lapiceoi(void)
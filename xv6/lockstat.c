@@ -0,0 +1,46 @@
+// Print the most contended kernel spin locks.
+//   lockstat [n]
+// Shows the n (10 by default) lock names that spent the most
+// cycles waiting, with how often they were taken, how often
+// that meant waiting, the cycles spent waiting (in units of
+// 1024) and the longest time any one was held (in cycles).
+
+#include "types.h"
+#include "param.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+#define NLOCK 64
+
+struct lockstat st[NLOCK];
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat t;
+  int i, j, n, top;
+
+  top = 10;
+  if(argc > 1)
+    top = atoi(argv[1]);
+  if((n = lockstat(st, NLOCK)) < 0){
+    printf(2, "lockstat: lockstat failed\n");
+    exit();
+  }
+  // Insertion sort, most time spent waiting first.
+  for(i = 1; i < n; i++){
+    t = st[i];
+    for(j = i; j > 0 && st[j-1].spin < t.spin; j--)
+      st[j] = st[j-1];
+    st[j] = t;
+  }
+  if(top > n)
+    top = n;
+  printf(1, "lock\t\tacquire\tcontend\tkspin\tmaxhold\n");
+  for(i = 0; i < top; i++)
+    printf(1, "%s\t%s%d\t%d\t%d\t%d\n", st[i].name,
+           strlen(st[i].name) < 8 ? "\t" : "", st[i].acquires,
+           st[i].contended, (uint)(st[i].spin >> 10), st[i].maxhold);
+  exit();
+}
@@ -0,0 +1,90 @@
+// Hammer one kernel spin lock from all CPUs at once.
+//   locktorture [procs] [ticks]
+//   locktorture -u
+// Each process (one per CPU by default) calls uptime(), which
+// does little but take and release tickslock, as often as it
+// can for the given number of ticks (200 by default). Prints
+// the total number of acquisitions, and the fewest and most
+// any one process got, which shows how fair the lock is.
+// Compare kernels built with and without LOCK=TICKET.
+//
+// With -u, instead time the uncontended path: the cycles one
+// process takes per uptime() call, mostly system call entry
+// and exit, acquire() and release(), which depend on how fast
+// mycpu() and myproc() are.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "user.h"
+#include "kstat.h"
+#include "x86.h"
+
+#define NCALL 100000
+
+void
+uncontended(void)
+{
+  uint64 t0, t1;
+  int i;
+
+  t0 = rdtsc();
+  for(i = 0; i < NCALL; i++)
+    uptime();
+  t1 = rdtsc();
+  printf(1, "locktorture: %d cycles per uptime()\n", (uint)(t1 - t0) / NCALL);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedstat st;
+  int fds[2], nproc, len, i, n, end, total, min, max;
+
+  if(argc > 1 && strcmp(argv[1], "-u") == 0){
+    uncontended();
+    exit();
+  }
+  nproc = 1;
+  if(schedstat(&st) == 0)
+    nproc = st.ncpu;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  len = 200;
+  if(argc > 2)
+    len = atoi(argv[2]);
+  if(pipe(fds) < 0){
+    printf(2, "locktorture: pipe failed\n");
+    exit();
+  }
+
+  // Start everyone at the next tick.
+  end = uptime() + 1;
+  while(uptime() < end)
+    ;
+  end += len;
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      n = 0;
+      while(uptime() < end)
+        n++;
+      write(fds[1], &n, sizeof(n));
+      exit();
+    }
+  }
+  close(fds[1]);
+  total = max = 0;
+  min = -1;
+  while(read(fds[0], &n, sizeof(n)) == sizeof(n)){
+    total += n;
+    if(min < 0 || n < min)
+      min = n;
+    if(n > max)
+      max = n;
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  printf(1, "locktorture: %d procs, %d ticks: %d acquires, per proc min %d max %d\n",
+         nproc, len, total, min, max);
+  exit();
+}
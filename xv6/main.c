@@ -28,11 +28,17 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
+  slabinit();      // object caches
+  pcacheinit();    // page cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  seminit();       // semaphores
+  pciinit();       // PCI devices
+  ioschedinit();   // disk request queue
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized to free memory
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -12,6 +12,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
@@ -32,9 +33,24 @@ ideintr(void)
   // no-op
 }
 
+// No DMA here.
+int
+setidedma(int on)
+{
+  return on ? -1 : 0;
+}
+
+void
+idestat(struct idestat *st)
+{
+  memset(st, 0, sizeof(*st));
+  safestrcpy(st->driver, "memide", sizeof(st->driver));
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, release the buf when done.
 void
 iderw(struct buf *b)
 {
@@ -57,4 +73,8 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    basyncdone(b);
+  }
 }
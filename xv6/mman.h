@@ -0,0 +1,11 @@
+// mmap() protection bits and flags.
+// Both the kernel and user programs use this header file.
+
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+
+#define MAP_SHARED   0x01  // writes go to the file, and are shared
+#define MAP_PRIVATE  0x02  // writes go to a private copy
+#define MAP_ANON     0x20  // not backed by a file; fd is ignored
+
+#define MAP_FAILED   ((void*)-1)
@@ -17,9 +17,10 @@
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_KCPU  6  // kernel per-cpu data, in %gs
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
@@ -94,12 +95,20 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (bit available to software)
+#define PTE_SHARED      0x400   // MAP_SHARED page, not copied on fork
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Page fault error code bits (tf->err for T_PGFLT)
+#define FEC_P           0x1     // Protection violation on a present page
+#define FEC_WR          0x2     // Fault caused by a write
+#define FEC_U           0x4     // Fault happened in user mode
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
@@ -0,0 +1,47 @@
+// Time path lookups run by several processes at once, all
+// through the same directories.
+//   namebench [nproc [lookups [path]]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, n, i, j, t0;
+  char *path;
+  struct stat st;
+
+  nproc = 4;
+  n = 2000;
+  path = "/README";
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    n = atoi(argv[2]);
+  if(argc > 3)
+    path = argv[3];
+  if(stat(path, &st) < 0){
+    printf(2, "namebench: cannot stat %s\n", path);
+    exit();
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      for(j = 0; j < n; j++){
+        if(stat(path, &st) < 0){
+          printf(2, "namebench: stat failed\n");
+          break;
+        }
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  printf(1, "%d processes: %d ticks for %d lookups of %s each\n",
+         nproc, uptime() - t0, n, path);
+  exit();
+}
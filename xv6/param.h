@@ -1,14 +1,20 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduling priority levels
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // file-backed memory regions per process
+#define NSEM         64  // semaphores in the system
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // maximum file path name
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#ifndef BUFMEM
+#define BUFMEM        2  // percent of free memory for the disk block cache
+#endif
+#define FSSIZE       2000  // size of file system in blocks
+#define MAXORDER     10  // largest contiguous allocation is 2^MAXORDER pages
 
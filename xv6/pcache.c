@@ -0,0 +1,277 @@
+// Page cache.
+//
+// Keeps whole pages of file data, keyed by (device, inode
+// number, page index), so that processes running the same
+// program share its text pages and exec() does not have to
+// read the program at all: pagefault() maps pages straight
+// out of the cache. MAP_SHARED file mappings map the cached
+// pages writable; readi() and writei() go through the cache
+// to stay coherent with them, and the dirty pages are written
+// back to the file through the log when unmapped.
+//
+// The cache holds one reference (see kincref) to each page it
+// keeps, and each mapping of the page holds another. Pages
+// are kept in LRU order; the least recently used ones that
+// only the cache refers to are given back when kalloc() runs
+// out of memory.
+//
+// Pages of an inode are only filled, written and dropped with
+// the inode locked exclusively, so the page contents need no
+// other lock. pcache.lock, a reader-writer lock, protects the
+// hash chains, the LRU list and the counters; pclook() and
+// pcwrite() only look pages up, so they take it shared and
+// readers of different files do not wait for each other.
+//
+// Interface:
+// * pcget(ip, idx) returns page idx of locked inode ip, with a
+//   reference for the caller, reading it from the file if
+//   necessary.
+// * pclook(ip, idx) returns page idx of ip with a reference,
+//   if it is cached, so that readi() can read pages which
+//   MAP_SHARED mappings may have changed.
+// * pcwrite(ip, src, off, n) keeps cached pages up to date
+//   when writei() changes the file.
+// * pcdrop(ip) forgets ip's pages when it is truncated.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+
+#define NPCHASH 67
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint idx;           // page index in the file
+  char *data;
+  struct cpage *hnext;  // hash chain
+  struct cpage *next;   // LRU list, most recently used first
+  struct cpage *prev;
+};
+
+struct {
+  struct rwlock lock;
+  struct kmem_cache *cache;
+  struct cpage *hash[NPCHASH];
+  struct cpage lru;
+  struct cpage *free;   // entries given back by pcshrink()
+  uint npage;
+  uint hits;
+  uint misses;
+  uint reclaims;
+} pcache;
+
+static int pcshrink(int n);
+
+void
+pcacheinit(void)
+{
+  initrwlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("cpage", sizeof(struct cpage));
+  pcache.lru.next = pcache.lru.prev = &pcache.lru;
+  register_shrinker(pcshrink);
+}
+
+static struct cpage**
+pchash(uint dev, uint inum, uint idx)
+{
+  return &pcache.hash[(dev*31 + inum*17 + idx) % NPCHASH];
+}
+
+// Find a cached page. Caller must hold pcache.lock,
+// shared or exclusive.
+static struct cpage*
+pclookup(uint dev, uint inum, uint idx)
+{
+  struct cpage *cp;
+
+  for(cp = *pchash(dev, inum, idx); cp; cp = cp->hnext)
+    if(cp->dev == dev && cp->inum == inum && cp->idx == idx)
+      return cp;
+  return 0;
+}
+
+// Take cp out of the hash chain and the LRU list.
+// Caller must hold pcache.lock exclusively.
+static void
+pcremove(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  for(pp = pchash(cp->dev, cp->inum, cp->idx); *pp != cp; pp = &(*pp)->hnext)
+    ;
+  *pp = cp->hnext;
+  cp->prev->next = cp->next;
+  cp->next->prev = cp->prev;
+  cp->hnext = pcache.free;
+  pcache.free = cp;
+  pcache.npage--;
+}
+
+// Return page idx of ip's data, with a reference for the caller
+// (to be dropped with kfree). Bytes past the end of the file
+// are zero. Returns 0 if out of memory.
+// Caller must hold ip->lock exclusively.
+char*
+pcget(struct inode *ip, uint idx)
+{
+  struct cpage *cp, **hp;
+  char *data;
+  int n;
+
+  acquirewr(&pcache.lock);
+  if((cp = pclookup(ip->dev, ip->inum, idx)) != 0){
+    cp->prev->next = cp->next;
+    cp->next->prev = cp->prev;
+    cp->next = pcache.lru.next;
+    cp->prev = &pcache.lru;
+    pcache.lru.next->prev = cp;
+    pcache.lru.next = cp;
+    pcache.hits++;
+    kincref(cp->data);
+    releasewr(&pcache.lock);
+    return cp->data;
+  }
+  pcache.misses++;
+  if((cp = pcache.free) != 0)
+    pcache.free = cp->hnext;
+  releasewr(&pcache.lock);
+
+  if(cp == 0 && (cp = kmem_cache_alloc(pcache.cache)) == 0)
+    return 0;
+  if((data = kalloc()) == 0){
+    kmem_cache_free(pcache.cache, cp);
+    return 0;
+  }
+  n = 0;
+  if(idx*PGSIZE < ip->size && (n = readi(ip, data, idx*PGSIZE, PGSIZE)) < 0)
+    n = 0;
+  memset(data + n, 0, PGSIZE - n);
+
+  cp->dev = ip->dev;
+  cp->inum = ip->inum;
+  cp->idx = idx;
+  cp->data = data;
+  acquirewr(&pcache.lock);
+  hp = pchash(cp->dev, cp->inum, cp->idx);
+  cp->hnext = *hp;
+  *hp = cp;
+  cp->next = pcache.lru.next;
+  cp->prev = &pcache.lru;
+  pcache.lru.next->prev = cp;
+  pcache.lru.next = cp;
+  pcache.npage++;
+  kincref(data);  // the caller's; kalloc's is the cache's
+  releasewr(&pcache.lock);
+  return data;
+}
+
+// writei() wrote n bytes from src at offset off of ip:
+// update the cached copy, if any. The range must not
+// cross a page boundary.
+// Caller must hold ip->lock exclusively.
+void
+pcwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *cp;
+
+  if(pcache.npage == 0)
+    return;
+  acquirerd(&pcache.lock);
+  if((cp = pclookup(ip->dev, ip->inum, off / PGSIZE)) != 0)
+    memmove(cp->data + off % PGSIZE, src, n);
+  releaserd(&pcache.lock);
+}
+
+// Return page idx of ip with a reference for the caller, who
+// drops it with kfree(), or 0 if the page is not cached.
+// The caller can then copy to user memory, which may fault,
+// without holding pcache.lock.
+// Caller must hold ip->lock, shared or exclusive.
+char*
+pclook(struct inode *ip, uint idx)
+{
+  struct cpage *cp;
+  char *data;
+
+  if(pcache.npage == 0)
+    return 0;
+  data = 0;
+  acquirerd(&pcache.lock);
+  if((cp = pclookup(ip->dev, ip->inum, idx)) != 0){
+    data = cp->data;
+    kincref(data);
+  }
+  releaserd(&pcache.lock);
+  return data;
+}
+
+// Drop all of ip's cached pages. Pages that are still mapped
+// stay allocated until they are unmapped.
+// Caller must hold ip->lock exclusively.
+void
+pcdrop(struct inode *ip)
+{
+  struct cpage *cp, *next;
+  int i;
+
+  acquirewr(&pcache.lock);
+  for(i = 0; i < NPCHASH; i++){
+    for(cp = pcache.hash[i]; cp; cp = next){
+      next = cp->hnext;
+      if(cp->dev == ip->dev && cp->inum == ip->inum){
+        pcremove(cp);
+        kfree(cp->data);
+      }
+    }
+  }
+  releasewr(&pcache.lock);
+}
+
+// Called by kalloc() when memory is short: give back up to
+// n of the least recently used pages that are not mapped by
+// anyone. Returns the number of pages freed.
+//
+// kalloc() may be called with a slab cache locked, so the
+// entries go on pcache.free rather than back to the slab.
+static int
+pcshrink(int n)
+{
+  struct cpage *cp, *prev;
+  char *data;
+  int got;
+
+  got = 0;
+  acquirewr(&pcache.lock);
+  for(cp = pcache.lru.prev; cp != &pcache.lru && got < n; cp = prev){
+    prev = cp->prev;
+    if(krefcount(cp->data) != 1)
+      continue;
+    data = cp->data;
+    pcremove(cp);
+    kfree(data);
+    got++;
+  }
+  pcache.reclaims += got;
+  releasewr(&pcache.lock);
+  return got;
+}
+
+// Copy page cache counters out for the pcachestat system call.
+void
+pcachestat(struct pcachestat *st)
+{
+  acquirerd(&pcache.lock);
+  st->npage = pcache.npage;
+  st->hits = pcache.hits;
+  st->misses = pcache.misses;
+  st->reclaims = pcache.reclaims;
+  releaserd(&pcache.lock);
+}
@@ -0,0 +1,98 @@
+// Minimal PCI support: find the devices on bus 0 through
+// configuration mechanism #1, so drivers can look up their
+// device and its I/O ports.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "pci.h"
+
+#define CONFADDR  0xCF8
+#define CONFDATA  0xCFC
+
+#define NPCIDEV   32
+
+static struct pcidev pcidevs[NPCIDEV];
+static int npcidev;
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  outl(CONFADDR, 0x80000000 | (d->bus<<16) | (d->dev<<11) |
+       (d->func<<8) | (off & 0xFC));
+  return inl(CONFDATA);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint val)
+{
+  outl(CONFADDR, 0x80000000 | (d->bus<<16) | (d->dev<<11) |
+       (d->func<<8) | (off & 0xFC));
+  outl(CONFDATA, val);
+}
+
+void
+pciinit(void)
+{
+  struct pcidev *d;
+  uint dev, func, nfunc, id, class, i;
+
+  for(dev = 0; dev < 32; dev++){
+    nfunc = 1;
+    for(func = 0; func < nfunc && npcidev < NPCIDEV; func++){
+      d = &pcidevs[npcidev];
+      d->bus = 0;
+      d->dev = dev;
+      d->func = func;
+      id = pciread(d, PCI_VENDOR);
+      if((id & 0xFFFF) == 0xFFFF)  // nothing there
+        continue;
+      if(func == 0 && (pciread(d, PCI_HEADER) & PCI_MULTI))
+        nfunc = 8;
+      d->vendor = id & 0xFFFF;
+      d->device = id >> 16;
+      class = pciread(d, PCI_CLASS);
+      d->class = class >> 24;
+      d->subclass = class >> 16;
+      d->progif = class >> 8;
+      for(i = 0; i < 6; i++)
+        d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+      d->irq = pciread(d, PCI_INTR);
+      npcidev++;
+    }
+  }
+}
+
+// Find the first device with the given vendor and device IDs.
+struct pcidev*
+pcifind(ushort vendor, ushort device)
+{
+  int i;
+
+  for(i = 0; i < npcidev; i++)
+    if(pcidevs[i].vendor == vendor && pcidevs[i].device == device)
+      return &pcidevs[i];
+  return 0;
+}
+
+// Find the first device of the given class and subclass.
+struct pcidev*
+pcifindclass(uchar class, uchar subclass)
+{
+  int i;
+
+  for(i = 0; i < npcidev; i++)
+    if(pcidevs[i].class == class && pcidevs[i].subclass == subclass)
+      return &pcidevs[i];
+  return 0;
+}
+
+// Let d respond to I/O and memory accesses and act as a bus
+// master, so that it can do DMA.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_COMMAND,
+           pciread(d, PCI_COMMAND) | PCI_IO | PCI_MEM | PCI_MASTER);
+}
@@ -0,0 +1,28 @@
+// PCI devices, as found by pciinit() on bus 0.
+// See the PCI Local Bus Specification, chapter 6.
+
+#define PCI_VENDOR   0x00   // vendor ID (low), device ID (high)
+#define PCI_COMMAND  0x04   // command (low), status (high)
+  #define PCI_IO       0x0001   // respond to I/O space accesses
+  #define PCI_MEM      0x0002   // respond to memory space accesses
+  #define PCI_MASTER   0x0004   // may act as a bus master
+#define PCI_CLASS    0x08   // revision, prog. i/f, subclass, class
+#define PCI_HEADER   0x0C   // header type in bits 16-23
+  #define PCI_MULTI    0x00800000  // device has several functions
+#define PCI_BAR0     0x10   // base address registers, six of them
+#define PCI_INTR     0x3C   // interrupt line (low byte)
+
+#define PCI_BARIO    0x1    // base address is in I/O space
+
+struct pcidev {
+  uchar bus;
+  uchar dev;
+  uchar func;
+  uchar irq;                    // interrupt line the BIOS set up
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uint bar[6];                  // base addresses, as read
+};
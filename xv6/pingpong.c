@@ -0,0 +1,79 @@
+// Compare the round-trip time between two processes that
+// take turns using a pair of semaphores and a pair of pipes.
+//   pingpong [rounds]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+void
+semrun(int n)
+{
+  int ping, pong, i, t0;
+
+  ping = semcreate(0);
+  pong = semcreate(0);
+  if(ping < 0 || pong < 0){
+    printf(2, "pingpong: semcreate failed\n");
+    exit();
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    for(i = 0; i < n; i++){
+      semwait(ping);
+      sempost(pong);
+    }
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    sempost(ping);
+    semwait(pong);
+  }
+  wait();
+  printf(1, "semaphores: %d ticks for %d round trips\n", uptime() - t0, n);
+  semclose(ping);
+  semclose(pong);
+}
+
+void
+piperun(int n)
+{
+  int ping[2], pong[2], i, t0;
+  char c;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "pingpong: pipe failed\n");
+    exit();
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    for(i = 0; i < n; i++){
+      read(ping[0], &c, 1);
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    write(ping[1], "x", 1);
+    read(pong[0], &c, 1);
+  }
+  wait();
+  printf(1, "pipes: %d ticks for %d round trips\n", uptime() - t0, n);
+  close(ping[0]);
+  close(ping[1]);
+  close(pong[0]);
+  close(pong[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  n = 10000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  semrun(n);
+  piperun(n);
+  exit();
+}
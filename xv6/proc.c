@@ -4,14 +4,64 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "kstat.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
+// Scheduling policy, chosen at build time (make SCHED=...).
+//
+// Round robin (the default): every process is on level 0 of
+// its run queue and runs for one clock tick at a time.
+//
+// MLFQ: a multi-level feedback queue. A CPU runs processes
+// from the highest non-empty level of its run queue (level 0
+// is the highest). A process that uses up the quantum of its
+// level moves down a level; one that sleeps first keeps its
+// level, but the ticks it used count against its next quantum
+// so that it cannot stay on top by sleeping just before the
+// quantum ends. Every BOOSTTICKS ticks all processes go back
+// to their base level (see setpriority), so that CPU-bound
+// processes on low levels do not starve.
+#ifdef MLFQ
+#define BOOSTTICKS 100
+static int quantum[NPRIO] = { 1, 2, 4 };  // clock ticks per level
+#endif
+
+// Per-CPU run queues. A RUNNABLE process is on exactly one
+// of them. Processes are put on with ptable.lock held, so a
+// run queue lock nests inside ptable.lock; the scheduler takes
+// them off without holding ptable.lock, so that an idle CPU
+// does not touch it at all.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];  // one list per level
+  struct proc *tail[NPRIO];
+  int n;
+  uint switches;     // processes run by this CPU
+  uint steals;       // processes taken from other CPUs' queues
+  uint migrations;   // processes that last ran on another CPU
+} __attribute__((__aligned__(64)));
+
+static struct runq runq[NCPU];
+
+// Sleeping processes, hashed by the channel they sleep on,
+// newest first, so that wakeup() only looks at processes that
+// might be waiting on its channel. Protected by ptable.lock.
+#define NWAITQ 61
+static struct proc *waitq[NWAITQ];
+
+static struct proc**
+wqhash(void *chan)
+{
+  return &waitq[((uint)chan >> 2) % NWAITQ];
+}
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -19,11 +69,246 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void wakeproc(struct proc *p);
+static void freeproc(struct proc *p);
+static void jointhreads(void);
 
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+}
+
+//PAGEBREAK: 30
+// Run queues.
+
+// The run queue level p goes on.
+static int
+qlevel(struct proc *p)
+{
+#ifdef MLFQ
+  return p->prio;
+#else
+  return 0;
+#endif
+}
+
+// Put p at the tail of its level of rq.
+// Caller must hold rq->lock.
+static void
+rqpush(struct runq *rq, struct proc *p)
+{
+  int l;
+
+  l = qlevel(p);
+  p->rqnext = 0;
+  if(rq->tail[l])
+    rq->tail[l]->rqnext = p;
+  else
+    rq->head[l] = p;
+  rq->tail[l] = p;
+  rq->n++;
+}
+
+// A process was just put on CPU id's run queue: if that CPU
+// is halted, send it a reschedule interrupt, or else wake
+// some other halted CPU, which will steal the process.
+// Interrupts must be off.
+static void
+kick(int id)
+{
+  struct cpu *c;
+
+  c = &cpus[id];
+  if(!c->idle){
+    for(c = cpus; c < &cpus[ncpu]; c++)
+      if(c->idle)
+        break;
+    if(c == &cpus[ncpu])
+      return;
+  }
+  if(c != mycpu())
+    lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Make p RUNNABLE and put it on CPU p->cpu's run queue.
+// Caller must hold ptable.lock.
+static void
+makerunnable(struct proc *p)
+{
+  struct runq *rq;
+
+  if(!holding(&ptable.lock))
+    panic("makerunnable");
+  p->state = RUNNABLE;
+  rq = &runq[p->cpu];
+  acquire(&rq->lock);
+  rqpush(rq, p);
+  release(&rq->lock);
+  kick(p->cpu);
+}
+
+// Take the process at the head of the highest non-empty
+// level of rq off it, or return 0.
+static struct proc*
+rqpop(struct runq *rq)
+{
+  struct proc *p;
+  int l;
+
+  p = 0;
+  acquire(&rq->lock);
+  for(l = 0; l < NPRIO; l++){
+    if((p = rq->head[l]) != 0){
+      rq->head[l] = p->rqnext;
+      if(rq->head[l] == 0)
+        rq->tail[l] = 0;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// The CPU with the shortest run queue, for a new process.
+static int
+leastloaded(void)
+{
+  int i, best;
+
+  best = 0;
+  for(i = 1; i < ncpu; i++)
+    if(runq[i].n < runq[best].n)
+      best = i;
+  return best;
+}
+
+// Is any process waiting on any run queue?
+static int
+anyrunnable(void)
+{
+  int i;
+
+  for(i = 0; i < ncpu; i++)
+    if(runq[i].n > 0)
+      return 1;
+  return 0;
+}
+
+// Find a process for CPU id to run: the head of its own
+// queue, or else one stolen from the longest other queue.
+// The lengths are read without locks; rqpop() rechecks.
+static struct proc*
+pickproc(int id)
+{
+  struct proc *p;
+  int i, busiest;
+
+  if(runq[id].n > 0 && (p = rqpop(&runq[id])) != 0)
+    return p;
+  busiest = -1;
+  for(i = 0; i < ncpu; i++)
+    if(i != id && runq[i].n > 0 && (busiest < 0 || runq[i].n > runq[busiest].n))
+      busiest = i;
+  if(busiest < 0 || (p = rqpop(&runq[busiest])) == 0)
+    return 0;
+  runq[id].steals++;
+  return p;
+}
+
+// Called on each clock tick on a CPU that is running a process.
+// Returns 1 if the process should give up the CPU.
+int
+schedtick(void)
+{
+#ifdef MLFQ
+  struct proc *p = myproc();
+  struct runq *rq;
+  int l;
+
+  if(++p->qticks >= quantum[p->prio]){
+    // Used up its quantum: move down a level.
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->qticks = 0;
+    return 1;
+  }
+  // Let a process on a higher level run now.
+  rq = &runq[cpuid()];
+  for(l = 0; l < p->prio; l++)
+    if(rq->head[l])
+      return 1;
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+// Called on each clock tick on CPU 0: periodically move every
+// process back up to its base level.
+void
+schedboost(void)
+{
+#ifdef MLFQ
+  struct proc *p, *next, *q[NPRIO];
+  struct runq *rq;
+  int i, l;
+
+  if(ticks % BOOSTTICKS != 0)
+    return;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    p->prio = p->baseprio;
+    p->qticks = 0;
+  }
+  // Requeue the queued processes at their new levels. Only
+  // those actually on a queue: a scheduler may have taken a
+  // RUNNABLE process off and be about to run it.
+  for(i = 0; i < ncpu; i++){
+    rq = &runq[i];
+    acquire(&rq->lock);
+    for(l = 0; l < NPRIO; l++){
+      q[l] = rq->head[l];
+      rq->head[l] = rq->tail[l] = 0;
+    }
+    rq->n = 0;
+    for(l = 0; l < NPRIO; l++){
+      for(p = q[l]; p; p = next){
+        next = p->rqnext;
+        rqpush(rq, p);
+      }
+    }
+    release(&rq->lock);
+  }
+  release(&ptable.lock);
+#endif
+}
+
+// Copy run queue counters out for the schedstat system call.
+void
+schedstat(struct schedstat *st)
+{
+  struct runq *rq;
+  int i;
+
+  memset(st, 0, sizeof(*st));
+  st->ncpu = ncpu;
+  for(i = 0; i < ncpu; i++){
+    rq = &runq[i];
+    acquire(&rq->lock);
+    st->cpu[i].nrun = rq->n;
+    st->cpu[i].switches = rq->switches;
+    st->cpu[i].steals = rq->steals;
+    st->cpu[i].migrations = rq->migrations;
+    st->cpu[i].ticks = cpus[i].ticks;
+    st->cpu[i].idleticks = cpus[i].idleticks;
+    release(&rq->lock);
+  }
 }
 
 // Must be called with interrupts disabled
@@ -33,35 +318,27 @@ cpuid() {
 }
 
 // Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
+// rescheduled to another CPU while it uses the result.
+// %gs:0 is this CPU's cpu->self (see seginit).
 struct cpu*
 mycpu(void)
 {
-  int apicid, i;
-  
+  struct cpu *c;
+
   if(readeflags()&FL_IF)
     panic("mycpu called with interrupts enabled\n");
-  
-  apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
-  for (i = 0; i < ncpu; ++i) {
-    if (cpus[i].apicid == apicid)
-      return &cpus[i];
-  }
-  panic("unknown apicid\n");
+  asm volatile("movl %%gs:0, %0" : "=r" (c));
+  return c;
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// The process running on this CPU, %gs:4. Being a single load,
+// this needs no pushcli: if the process is moved to another
+// CPU straight afterwards, it is still the same process.
 struct proc*
 myproc(void) {
-  struct cpu *c;
   struct proc *p;
-  pushcli();
-  c = mycpu();
-  p = c->proc;
-  popcli();
+
+  asm volatile("movl %%gs:4, %0" : "=r" (p));
   return p;
 }
 
@@ -88,6 +365,10 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->leader = p;
+  p->nthreads = 0;
+  p->vmbusy = 0;
+  p->vmheld = 0;
 
   release(&ptable.lock);
 
@@ -148,30 +429,41 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  p->cpu = 0;
+  makerunnable(p);
 
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size, or -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz;
   struct proc *curproc = myproc();
+  struct proc *l = curproc->leader;
 
-  sz = curproc->sz;
+  vmlock(curproc);
+  sz = oldsz = l->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space; pagefault() allocates
+    // pages on first touch. Refuse to promise more than is free.
+    if(sz + n < sz || sz + n > MMAPBASE || n / PGSIZE > kfreepages()){
+      vmunlock(curproc);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      vmunlock(curproc);
       return -1;
+    }
+    tlbflush(curproc->pgdir);
   }
-  curproc->sz = sz;
-  switchuvm(curproc);
-  return 0;
+  l->sz = sz;
+  vmunlock(curproc);
+  return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -183,6 +475,7 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *curproc = myproc();
+  struct proc *l = curproc->leader;
 
   // Allocate process.
   if((np = allocproc()) == 0){
@@ -190,22 +483,31 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  vmlock(curproc);
+  np->pgdir = copyuvm(curproc->pgdir, l->sz);
+  // copyuvm made the parent's writable pages read-only.
+  tlbflush(curproc->pgdir);
+  if(np->pgdir == 0){
+    vmunlock(curproc);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
-  np->sz = curproc->sz;
+  np->sz = l->sz;
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = l->vma[i];
+    if(np->vma[i].ip)
+      np->vma[i].ip = idup(np->vma[i].ip);
+  }
+  vmunlock(curproc);
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
+  fdcopy(np->ofile);
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
@@ -214,7 +516,10 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  np->cpu = leastloaded();
+  np->prio = np->baseprio = curproc->baseprio;
+  np->qticks = 0;
+  makerunnable(np);
 
   release(&ptable.lock);
 
@@ -234,7 +539,11 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
+  // Threads must not outlive the address space.
+  jointhreads();
+
+  // Close all open files. A thread's are its leader's, which
+  // the leader closes once its threads are gone.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
       fileclose(curproc->ofile[fd]);
@@ -242,6 +551,9 @@ exit(void)
     }
   }
 
+  if(curproc->leader == curproc)
+    vmaclear(curproc->pgdir, curproc->vma);
+
   begin_op();
   iput(curproc->cwd);
   end_op();
@@ -249,6 +561,9 @@ exit(void)
 
   acquire(&ptable.lock);
 
+  if(curproc->leader != curproc)
+    curproc->leader->nthreads--;
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
@@ -267,6 +582,20 @@ exit(void)
   panic("zombie exit");
 }
 
+// Free the kernel stack and process table entry of p, a
+// zombie. Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  kfree(p->kstack);
+  p->kstack = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
@@ -281,20 +610,14 @@ wait(void)
     // Scan through table looking for exited children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+      if(p->parent != curproc || p->leader != p)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -311,11 +634,211 @@ wait(void)
   }
 }
 
+//PAGEBREAK: 40
+// Threads.
+
+// Create a thread that shares the current process's address
+// space, starting at fn(arg) with its stack pointer at stack.
+// It shares the open files too, using the leader's table, and
+// the caller reaps it with join().
+// Returns the new thread's pid, or -1.
+int
+clone(uint fn, uint arg, uint stack)
+{
+  int pid;
+  uint sp, ustk[2];
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  sp = stack - 8;
+  if(stack % 4 != 0 || sp > stack)
+    return -1;
+  // The new thread starts as if fn had been called with arg,
+  // from a return address that faults if fn returns.
+  ustk[0] = 0xffffffff;
+  ustk[1] = arg;
+  if(storemem(sp, ustk, sizeof(ustk)) < 0)
+    return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = curproc->pgdir;
+  np->leader = curproc->leader;
+  np->sz = 0;
+  np->ustack = stack;
+  np->parent = curproc;
+  *np->tf = *curproc->tf;
+  np->tf->eip = fn;
+  np->tf->esp = sp;
+
+  np->cwd = idup(curproc->cwd);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->leader->nthreads++;
+  np->cpu = leastloaded();
+  np->prio = np->baseprio = curproc->baseprio;
+  np->qticks = 0;
+  makerunnable(np);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Wait for a thread the current process created to exit.
+// Return its pid, and the stack it was given in *stack,
+// or -1 if the process has no threads.
+int
+join(uint *stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for(;;){
+    havekids = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->parent != curproc || p->leader == p)
+        continue;
+      havekids = 1;
+      if(p->state == ZOMBIE){
+        pid = p->pid;
+        *stack = p->ustack;
+        freeproc(p);
+        release(&ptable.lock);
+        return pid;
+      }
+    }
+    if(!havekids || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(curproc, &ptable.lock);
+  }
+}
+
+// Kill the threads the current process created, and wait for
+// them to exit. Threads kill and wait for their own threads
+// in turn, so a process outlives all threads that share its
+// address space.
+static void
+jointhreads(void)
+{
+  struct proc *p;
+  struct proc *curproc = myproc();
+  int live;
+
+  acquire(&ptable.lock);
+  for(;;){
+    live = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->parent != curproc || p->leader == p)
+        continue;
+      if(p->state == ZOMBIE){
+        freeproc(p);
+        continue;
+      }
+      live = 1;
+      p->killed = 1;
+      if(p->state == SLEEPING)
+        wakeproc(p);
+    }
+    if(!live)
+      break;
+    sleep(curproc, &ptable.lock);
+  }
+  release(&ptable.lock);
+}
+
+// Lock the address space p uses against the other threads
+// sharing it, for page faults, sbrk(), mmap() and the like,
+// which may sleep. A process with no threads has nobody to
+// lock out (and cannot gain a thread meanwhile), so skips it.
+void
+vmlock(struct proc *p)
+{
+  struct proc *l = p->leader;
+
+  if(l->nthreads == 0)
+    return;
+  acquire(&ptable.lock);
+  while(l->vmbusy)
+    sleep(&l->vmbusy, &ptable.lock);
+  l->vmbusy = 1;
+  p->vmheld = 1;
+  release(&ptable.lock);
+}
+
+void
+vmunlock(struct proc *p)
+{
+  if(!p->vmheld)
+    return;
+  acquire(&ptable.lock);
+  p->vmheld = 0;
+  p->leader->vmbusy = 0;
+  wakeup1(&p->leader->vmbusy);
+  release(&ptable.lock);
+}
+
+// Flush the TLB of this CPU, and of every other CPU that is
+// running a thread with page table pgdir, after mappings in
+// pgdir were removed or made less permissive. Other CPUs are
+// sent an IPI, and this waits until they have flushed.
+void
+tlbflush(pde_t *pgdir)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  int n;
+
+  pushcli();
+  me = mycpu();
+  if(me->proc && me->proc->pgdir == pgdir)
+    lcr3(V2P(pgdir));
+  n = 0;
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c == me || (p = c->proc) == 0 || p->pgdir != pgdir)
+      continue;
+    c->tlbflush = 1;
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    n++;
+  }
+  for(c = cpus; n > 0 && c < &cpus[ncpu]; c++){
+    // Another CPU may be waiting for this one to flush, with
+    // interrupts off like this one.
+    while(c->tlbflush && c != me)
+      tlbintr();
+  }
+  popcli();
+}
+
+// Flush this CPU's TLB if tlbflush() asked it to.
+// Interrupts must be off.
+void
+tlbintr(void)
+{
+  struct cpu *c = mycpu();
+
+  if(xchg(&c->tlbflush, 0)){
+    if(c->proc)
+      lcr3(V2P(c->proc->pgdir));
+    else
+      switchkvm();
+  }
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process to run from this CPU's run queue,
+//    or steal one from another CPU's
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -324,34 +847,59 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  struct runq *rq;
+  int id;
   c->proc = 0;
+  id = c - cpus;
+  rq = &runq[id];
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+    if((p = pickproc(id)) == 0){
+      // Nothing to run: use the time to pre-zero a free page,
+      // or else halt until an interrupt arrives, such as the
+      // reschedule interrupt kick() sends once there is work.
+      // xchg orders setting c->idle before looking at the
+      // run queues, as kick() looks at c->idle only after
+      // putting a process on one.
+      if(kzeroidle())
         continue;
+      cli();
+      xchg(&c->idle, 1);
+      if(!anyrunnable())
+        halt();
+      c->idle = 0;
+      continue;
+    }
+
+    // The process is off the run queues, so no other CPU can
+    // pick it; ptable.lock waits for it to finish switching
+    // out if it has only just yielded.
+    acquire(&ptable.lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+    if(p->cpu != id){
+      rq->migrations++;
+      p->cpu = id;
+    }
+    rq->switches++;
 
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    c->proc = p;
+    switchuvm(p);
+    p->state = RUNNING;
 
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
 
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-    }
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
     release(&ptable.lock);
-
   }
 }
 
@@ -386,7 +934,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  makerunnable(myproc());
   sched();
   release(&ptable.lock);
 }
@@ -418,6 +966,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct proc **pp;
   
   if(p == 0)
     panic("sleep");
@@ -438,6 +987,9 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  pp = wqhash(chan);
+  p->wqnext = *pp;
+  *pp = p;
 
   sched();
 
@@ -452,16 +1004,37 @@ sleep(void *chan, struct spinlock *lk)
 }
 
 //PAGEBREAK!
+// Take sleeping process p off its wait queue and make it
+// RUNNABLE. The ptable lock must be held.
+static void
+wakeproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = wqhash(p->chan); *pp != p; pp = &(*pp)->wqnext)
+    if(*pp == 0)
+      panic("wakeproc");
+  *pp = p->wqnext;
+  p->wqnext = 0;
+  makerunnable(p);
+}
+
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc **pp, *p;
+
+  pp = wqhash(chan);
+  while((p = *pp) != 0){
+    if(p->chan == chan){
+      *pp = p->wqnext;
+      p->wqnext = 0;
+      makerunnable(p);
+    } else
+      pp = &p->wqnext;
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -473,6 +1046,26 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wake up the process that has slept longest on chan, if any.
+// For channels where any one waiter can make progress and
+// will pass the wakeup on if there is more to do, such as
+// sleep locks, so that the rest need not all run only to go
+// back to sleep.
+void
+wakeup_one(void *chan)
+{
+  struct proc *p, *oldest;
+
+  acquire(&ptable.lock);
+  oldest = 0;
+  for(p = *wqhash(chan); p; p = p->wqnext)
+    if(p->chan == chan)
+      oldest = p;
+  if(oldest)
+    wakeproc(oldest);
+  release(&ptable.lock);
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -487,7 +1080,7 @@ kill(int pid)
       p->killed = 1;
       // Wake process from sleep if necessary.
       if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+        wakeproc(p);
       release(&ptable.lock);
       return 0;
     }
@@ -532,3 +1125,47 @@ procdump(void)
     cprintf("\n");
   }
 }
+
+// Set the base scheduling level of the process with the given
+// pid, and move it to that level. Under MLFQ the process may
+// fall below its base level but boosting does not raise it
+// above it. A RUNNABLE process moves when it is next queued.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      p->prio = p->baseprio = prio;
+      p->qticks = 0;
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Return the current scheduling level of the process with
+// the given pid.
+int
+getpriority(int pid)
+{
+  struct proc *p;
+  int prio;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      prio = p->prio;
+      release(&ptable.lock);
+      return prio;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
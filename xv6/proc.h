@@ -7,7 +7,14 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  // %gs points here, so that mycpu() and myproc() are one load:
+  // self at %gs:0 and proc at %gs:4 (see seginit).
+  struct cpu *self;            // This struct cpu
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint idle;          // Halted in scheduler() for lack of work?
+  volatile uint tlbflush;      // Asked to flush its TLB by tlbflush()
+  uint ticks;                  // Clock ticks taken
+  uint idleticks;              // ... of which while idle
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,6 +39,22 @@ struct context {
   uint eip;
 };
 
+// A region of user memory: a program segment, or a mapping
+// made by mmap(). pagefault() maps pages of file-backed
+// regions out of the page cache on first touch.
+struct vma {
+  uint start;          // first address, page aligned
+  uint end;            // end address, page aligned; 0 if unused
+  uint zero;           // memory from here to end is zero-filled
+  uint off;            // file offset of start, page aligned
+  int flags;
+  struct inode *ip;    // file, or 0 for anonymous memory
+};
+
+#define VMA_WRITE   0x1  // writable
+#define VMA_SHARED  0x2  // writes go to the file (or are shared
+                         // with children), not to private copies
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -45,12 +68,28 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Next on chan's wait queue
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // File-backed memory regions
   char name[16];               // Process name (debugging)
+  int cpu;                     // Run queue it is on, or last ran on
+  struct proc *rqnext;         // Next on that run queue
+  int prio;                    // Scheduling level, 0 highest
+  int baseprio;                // Level set by setpriority
+  int qticks;                  // Clock ticks used at this level
+  struct proc *leader;         // Process whose address space this is
+  int nthreads;                // Leader: live threads sharing it
+  int vmbusy;                  // Leader: address space locked
+  int vmheld;                  // Holds the leader's vmbusy
+  uint ustack;                 // Thread: stack passed to clone()
 };
 
+// A thread made by clone() shares the page table of the process
+// that made it, and uses its leader's sz, vma and ofile instead
+// of its own; p->leader is p itself for a process.
+
 // Process memory is laid out contiguously, low addresses first:
 //   text
 //   original data and bss
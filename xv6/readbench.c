@@ -0,0 +1,90 @@
+// Time processes reading files in parallel.
+//   readbench [nproc [rounds]]
+// Each process reads its own small file, in its own directory,
+// over and over, so that all the blocks they read stay in the
+// buffer cache and no two processes read the same block. Run
+// with CPUS=8 and compare nproc 1 with nproc 8; lockstat shows
+// how much of the time went to the buffer cache locks.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NBLK 2   // blocks per file
+
+char buf[NBLK*BSIZE];
+
+void
+name(char *dir, int i)
+{
+  dir[0] = 'r';
+  dir[1] = 'b';
+  dir[2] = '0' + i / 10;
+  dir[3] = '0' + i % 10;
+  dir[4] = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, n, i, j, fd, t0;
+  char dir[8];
+
+  nproc = 8;
+  n = 500;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    n = atoi(argv[2]);
+  if(nproc < 1 || nproc > 99){
+    printf(2, "readbench: 1 to 99 processes\n");
+    exit();
+  }
+
+  for(i = 0; i < nproc; i++){
+    name(dir, i);
+    if(mkdir(dir) < 0 || chdir(dir) < 0){
+      printf(2, "readbench: cannot make %s\n", dir);
+      exit();
+    }
+    if((fd = open("data", O_CREATE|O_RDWR)) < 0 ||
+       write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "readbench: cannot write %s/data\n", dir);
+      exit();
+    }
+    close(fd);
+    chdir("..");
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      name(dir, i);
+      chdir(dir);
+      for(j = 0; j < n; j++){
+        if((fd = open("data", O_RDONLY)) < 0 ||
+           read(fd, buf, sizeof(buf)) != sizeof(buf)){
+          printf(2, "readbench: read failed\n");
+          break;
+        }
+        close(fd);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  printf(1, "%d processes: %d ticks for %d reads of %d blocks each\n",
+         nproc, uptime() - t0, n, NBLK);
+
+  for(i = 0; i < nproc; i++){
+    name(dir, i);
+    chdir(dir);
+    unlink("data");
+    chdir("..");
+    unlink(dir);
+  }
+  exit();
+}
@@ -0,0 +1,141 @@
+// Check that reading large files does not push metadata out
+// of the buffer cache.
+//   scanbench [rounds]
+// Makes NSMALL empty files and NBIG files of the largest size,
+// then stat()s the small files over and over, first alone and
+// then while another process reads the big files, and prints
+// the buffer cache's metadata hits and misses for each run.
+// Build with BUFMEM=0 (see the Makefile).
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+#define NSMALL 40
+#define NBIG   3
+
+char buf[BSIZE];
+
+void
+name(char *s, char c, int i)
+{
+  s[0] = 's';
+  s[1] = 'b';
+  s[2] = '/';
+  s[3] = c;
+  s[4] = '0' + i / 10;
+  s[5] = '0' + i % 10;
+  s[6] = 0;
+}
+
+void
+scan(void)
+{
+  char path[8];
+  int i, fd;
+
+  for(;;){
+    for(i = 0; i < NBIG; i++){
+      name(path, 'b', i);
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf(2, "scanbench: cannot open %s\n", path);
+        exit();
+      }
+      while(read(fd, buf, sizeof(buf)) > 0)
+        ;
+      close(fd);
+    }
+  }
+}
+
+void
+run(char *what, int rounds, int scanning)
+{
+  struct bcachestat st0, st1;
+  struct stat st;
+  char path[8];
+  int pid, i, j, t0, hits, misses;
+
+  pid = 0;
+  if(scanning && (pid = fork()) == 0)
+    scan();
+  if(scanning)
+    sleep(10);  // let the scan fill the cache
+
+  bcachestat(&st0);
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    for(j = 0; j < NSMALL; j++){
+      name(path, 's', j);
+      if(stat(path, &st) < 0){
+        printf(2, "scanbench: cannot stat %s\n", path);
+        break;
+      }
+    }
+  }
+  t0 = uptime() - t0;
+  bcachestat(&st1);
+  if(pid > 0){
+    kill(pid);
+    wait();
+  }
+
+  hits = st1.metahits - st0.metahits;
+  misses = st1.metamisses - st0.metamisses;
+  printf(1, "%s: %d ticks, metadata %d hits %d misses (%d%% hit)\n",
+         what, t0, hits, misses,
+         hits + misses ? hits * 100 / (hits + misses) : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[8];
+  int rounds, i, j, fd;
+
+  rounds = 50;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  if(mkdir("sb") < 0){
+    printf(2, "scanbench: cannot make sb\n");
+    exit();
+  }
+  for(i = 0; i < NSMALL; i++){
+    name(path, 's', i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(2, "scanbench: cannot create %s\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  for(i = 0; i < NBIG; i++){
+    name(path, 'b', i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(2, "scanbench: cannot create %s\n", path);
+      exit();
+    }
+    for(j = 0; j < MAXFILE; j++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+        break;
+    close(fd);
+  }
+
+  run("stat alone", rounds, 0);
+  run("stat during scan", rounds, 1);
+
+  for(i = 0; i < NSMALL; i++){
+    name(path, 's', i);
+    unlink(path);
+  }
+  for(i = 0; i < NBIG; i++){
+    name(path, 'b', i);
+    unlink(path);
+  }
+  unlink("sb");
+  exit();
+}
@@ -0,0 +1,67 @@
+// Measure how long an interactive process waits for the CPU
+// while CPU-bound processes run.
+//   schedbench [hogs]
+// Starts the given number of CPU-bound processes (4 by
+// default), then sleeps for one tick at a time and counts how
+// many ticks each sleep really took. Compare kernels built
+// with and without SCHED=MLFQ.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N     200
+#define MAXLAT 8
+
+int
+main(int argc, char *argv[])
+{
+  int i, nhog, pid[16], hist[MAXLAT+1], t, total, worst;
+  volatile int spin;
+
+  nhog = 4;
+  if(argc > 1)
+    nhog = atoi(argv[1]);
+  if(nhog < 0 || nhog > 16){
+    printf(2, "schedbench: at most 16 hogs\n");
+    exit();
+  }
+  for(i = 0; i < nhog; i++){
+    if((pid[i] = fork()) < 0){
+      printf(2, "schedbench: fork failed\n");
+      exit();
+    }
+    if(pid[i] == 0)
+      for(spin = 0;; spin++)
+        ;
+  }
+
+  memset(hist, 0, sizeof(hist));
+  total = worst = 0;
+  for(i = 0; i < N; i++){
+    t = uptime();
+    sleep(1);
+    t = uptime() - t;
+    total += t;
+    if(t > worst)
+      worst = t;
+    hist[t < MAXLAT ? t : MAXLAT]++;
+  }
+
+  printf(1, "schedbench: %d hogs, %d sleeps of 1 tick\n", nhog, N);
+  printf(1, "ticks\tcount\n");
+  for(i = 0; i <= MAXLAT; i++)
+    if(hist[i])
+      printf(1, "%d%s\t%d\n", i, i == MAXLAT ? "+" : "", hist[i]);
+  printf(1, "total %d worst %d\n", total, worst);
+  printf(1, "priority: self %d", getpriority(getpid()));
+  for(i = 0; i < nhog; i++)
+    printf(1, " hog %d", getpriority(pid[i]));
+  printf(1, "\n");
+
+  for(i = 0; i < nhog; i++)
+    kill(pid[i]);
+  for(i = 0; i < nhog; i++)
+    wait();
+  exit();
+}
@@ -0,0 +1,173 @@
+// Counting semaphores, for processes to wait for each other.
+//
+// Semaphores live in one system-wide table and are named by
+// their index in it, so related processes share one by
+// passing the number along (e.g. across fork()).
+//
+// Each semaphore keeps its own FIFO queue of waiters. A waiter
+// sleeps on a struct semwaiter on its own kernel stack, and
+// sempost() with waiters hands the count straight to the first
+// of them and wakes just that one, instead of waking everyone
+// sleeping on the semaphore to race for it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct semwaiter {
+  struct semwaiter *next;
+  int granted;                // sempost() gave us the count
+};
+
+struct sem {
+  struct spinlock lock;
+  int used;
+  int value;
+  struct semwaiter *head;     // waiters, oldest first
+  struct semwaiter *tail;
+};
+
+struct {
+  struct spinlock lock;       // protects allocation
+  struct sem sem[NSEM];
+} semtable;
+
+void
+seminit(void)
+{
+  int i;
+
+  initlock(&semtable.lock, "semtable");
+  for(i = 0; i < NSEM; i++)
+    initlock(&semtable.sem[i].lock, "sem");
+}
+
+// Return semaphore id, locked, or 0 if there is no such one.
+static struct sem*
+semget(int id)
+{
+  struct sem *s;
+
+  if(id < 0 || id >= NSEM)
+    return 0;
+  s = &semtable.sem[id];
+  acquire(&s->lock);
+  if(!s->used){
+    release(&s->lock);
+    return 0;
+  }
+  return s;
+}
+
+// Create a semaphore with the given initial value.
+// Returns its id, or -1 if the table is full.
+int
+semcreate(int value)
+{
+  struct sem *s;
+
+  if(value < 0)
+    return -1;
+  acquire(&semtable.lock);
+  for(s = semtable.sem; s < &semtable.sem[NSEM]; s++){
+    acquire(&s->lock);
+    if(!s->used){
+      s->used = 1;
+      s->value = value;
+      s->head = s->tail = 0;
+      release(&s->lock);
+      release(&semtable.lock);
+      return s - semtable.sem;
+    }
+    release(&s->lock);
+  }
+  release(&semtable.lock);
+  return -1;
+}
+
+// Wait until the semaphore's value is positive, then
+// decrement it. Returns -1 if there is no such semaphore
+// or the process is killed while waiting.
+int
+semwait(int id)
+{
+  struct sem *s;
+  struct semwaiter w, *q, *prev;
+
+  if((s = semget(id)) == 0)
+    return -1;
+  if(s->value > 0){
+    s->value--;
+    release(&s->lock);
+    return 0;
+  }
+  w.next = 0;
+  w.granted = 0;
+  if(s->tail)
+    s->tail->next = &w;
+  else
+    s->head = &w;
+  s->tail = &w;
+  while(!w.granted && !myproc()->killed)
+    sleep(&w, &s->lock);
+  if(!w.granted){
+    // Killed: leave the queue.
+    prev = 0;
+    for(q = s->head; q != &w; q = q->next)
+      prev = q;
+    if(prev)
+      prev->next = w.next;
+    else
+      s->head = w.next;
+    if(s->tail == &w)
+      s->tail = prev;
+    release(&s->lock);
+    return -1;
+  }
+  release(&s->lock);
+  return 0;
+}
+
+// Increment the semaphore's value, or rather give it to the
+// oldest waiter, if any. Returns -1 if there is no such
+// semaphore.
+int
+sempost(int id)
+{
+  struct sem *s;
+  struct semwaiter *w;
+
+  if((s = semget(id)) == 0)
+    return -1;
+  if((w = s->head) != 0){
+    s->head = w->next;
+    if(s->head == 0)
+      s->tail = 0;
+    w->granted = 1;
+    wakeup_one(w);
+  } else
+    s->value++;
+  release(&s->lock);
+  return 0;
+}
+
+// Free the semaphore. Returns -1 if there is no such semaphore
+// or processes are waiting on it.
+int
+semclose(int id)
+{
+  struct sem *s;
+
+  if((s = semget(id)) == 0)
+    return -1;
+  if(s->head){
+    release(&s->lock);
+    return -1;
+  }
+  s->used = 0;
+  release(&s->lock);
+  return 0;
+}
@@ -0,0 +1,261 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A cache hands out objects of one size. Objects are carved
+// out of slabs, each slab being one page from kalloc() with a
+// struct slab header at its start; free objects in a slab are
+// linked through their first word.
+//
+// Each CPU keeps a small magazine of free objects per cache,
+// so kmem_cache_alloc() and kmem_cache_free() usually only
+// disable interrupts. The cache lock is taken to move half a
+// magazine at a time between the magazine and the slabs.
+//
+// Interface:
+// * kmem_cache_create(name, size) makes a new cache.
+// * kmem_cache_alloc(c) returns an uninitialized object, or 0.
+// * kmem_cache_free(c, obj) gives it back.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "kstat.h"
+
+#define NSLABCACHE  16  // maximum number of caches
+#define MAGSIZE     16  // objects per CPU magazine
+
+struct slab {
+  struct slab *next;         // on one of the cache's slab lists
+  struct slab *prev;
+  struct kmem_cache *cache;
+  uint inuse;                // objects handed out of this slab
+  void *freelist;            // free objects in this slab
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+} __attribute__((__aligned__(64)));
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;                 // object size, rounded up
+  uint perslab;              // objects per slab
+  struct slab partial;       // slabs with some free objects
+  struct slab full;          // slabs with no free objects
+  struct slab *empty;        // at most one slab with no objects in use
+  uint nslab;                // slabs (pages) held
+  uint nalloc;               // objects out of slabs, incl. magazines
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache cache[NSLABCACHE];
+} slabs;
+
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7)
+
+static void
+slablink(struct slab *h, struct slab *s)
+{
+  s->next = h->next;
+  s->prev = h;
+  h->next->prev = s;
+  h->next = s;
+}
+
+static void
+slabunlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Create a cache of objects of the given size.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*) || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NSLABCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n];
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  slabs.n++;
+  release(&slabs.lock);
+  return c;
+}
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Get a new slab page and thread its objects onto its free list.
+// Caller must hold c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  p = (char*)s + SLABHDR;
+  for(i = 0; i < c->perslab; i++, p += c->size){
+    *(void**)p = s->freelist;
+    s->freelist = p;
+  }
+  c->nslab++;
+  return s;
+}
+
+// Take one object out of the slabs. Caller must hold c->lock.
+static void*
+slabget(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if(c->partial.next != &c->partial){
+    s = c->partial.next;
+    slabunlink(s);
+  } else if(c->empty){
+    s = c->empty;
+    c->empty = 0;
+  } else if((s = slabgrow(c)) == 0)
+    return 0;
+
+  obj = s->freelist;
+  s->freelist = *(void**)obj;
+  s->inuse++;
+  if(s->freelist)
+    slablink(&c->partial, s);
+  else
+    slablink(&c->full, s);
+  c->nalloc++;
+  return obj;
+}
+
+// Return one object to its slab. Caller must hold c->lock.
+static void
+slabput(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != c || s->inuse == 0)
+    panic("kmem_cache_free");
+  *(void**)obj = s->freelist;
+  s->freelist = obj;
+  s->inuse--;
+  c->nalloc--;
+  slabunlink(s);
+  if(s->inuse > 0){
+    slablink(&c->partial, s);
+    return;
+  }
+  // Keep one empty slab around to absorb alloc/free bursts.
+  if(c->empty == 0){
+    c->empty = s;
+    return;
+  }
+  c->nslab--;
+  kfree((char*)s);
+}
+
+//PAGEBREAK!
+// Allocate an object from cache c.
+// Returns 0 if no memory is available.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    // Refill half the magazine.
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (obj = slabget(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  popcli();
+  return obj;
+}
+
+// Return an object to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    // Flush half the magazine back to the slabs.
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  popcli();
+}
+
+// Copy per-cache counters out for the slabstat system call.
+// Returns the number of caches, at most n.
+int
+slabstat(struct slabstat *st, int n)
+{
+  struct kmem_cache *c;
+  int i, j, nmag;
+
+  acquire(&slabs.lock);
+  if(n > slabs.n)
+    n = slabs.n;
+  release(&slabs.lock);
+  for(i = 0; i < n; i++){
+    c = &slabs.cache[i];
+    memset(&st[i], 0, sizeof(st[i]));
+    safestrcpy(st[i].name, c->name, sizeof(st[i].name));
+    acquire(&c->lock);
+    nmag = 0;
+    for(j = 0; j < ncpu; j++)
+      nmag += c->mag[j].n;
+    st[i].size = c->size;
+    st[i].perslab = c->perslab;
+    st[i].nslab = c->nslab;
+    st[i].inuse = c->nalloc - nmag;
+    st[i].cached = nmag;
+    release(&c->lock);
+  }
+  return n;
+}
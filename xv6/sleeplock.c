@@ -13,7 +13,7 @@
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
-  initlock(&lk->lk, "sleep lock");
+  initlock(&lk->lk, name);
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
@@ -37,7 +37,7 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeup_one(lk);
   release(&lk->lk);
 }
 
@@ -52,5 +52,75 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+//PAGEBREAK!
+// Reader-writer sleeping locks
 
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  initlock(&lk->lk, name);
+  lk->name = name;
+  lk->locked = 0;
+  lk->readers = 0;
+  lk->waiting = 0;
+  lk->pid = 0;
+}
 
+void
+acquirerdsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->waiting) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releaserdsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers <= 0)
+    panic("releaserdsleep");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+void
+acquirewrsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->waiting++;
+  while (lk->locked || lk->readers) {
+    sleep(lk, &lk->lk);
+  }
+  lk->waiting--;
+  lk->locked = 1;
+  lk->pid = myproc()->pid;
+  release(&lk->lk);
+}
+
+void
+releasewrsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->locked = 0;
+  lk->pid = 0;
+  // Readers and writers sleep on the same channel,
+  // so wake them all.
+  wakeup(lk);
+  release(&lk->lk);
+}
+
+int
+holdingwrsleep(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked && (lk->pid == myproc()->pid);
+  release(&lk->lk);
+  return r;
+}
@@ -8,3 +8,16 @@ struct sleeplock {
   int pid;           // Process holding lock
 };
 
+
+// Long-term reader-writer lock: any number of readers, or one
+// writer. Waiting writers hold off new readers.
+struct rwsleeplock {
+  uint locked;       // Is the lock held for writing?
+  int readers;       // Number of readers holding the lock
+  int waiting;       // Number of writers waiting
+  struct spinlock lk; // spinlock protecting this sleep lock
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding lock for writing
+};
@@ -9,11 +9,70 @@
 #include "proc.h"
 #include "spinlock.h"
 
+#include "kstat.h"
+
+// Ticket lock: pause this many times per waiter ahead of us
+// between looks at the lock, so that waiters far back in line
+// leave the cache line alone while the holder works.
+#define BACKOFF 50
+
+// Contention statistics, kept for each lock name (locks that
+// share a name, such as those of the buffers or semaphores,
+// are counted together) and on each CPU separately so that
+// counting needs no atomic instructions: the counting CPU
+// holds the lock, with interrupts off.
+#define NLOCKCLASS 64
+
+struct lockclass {
+  char *name;
+  struct {
+    uint acquires;
+    uint contended;   // acquires that had to wait
+    uint64 spin;      // cycles spent waiting
+    uint maxhold;     // longest hold, in cycles
+  } cpu[NCPU];
+};
+
+static struct {
+  uint lock;          // initlock() can run before mycpu() works
+  int n;
+  struct lockclass class[NLOCKCLASS];
+} lockclasses;
+
+// Find or make the statistics for locks named name,
+// or return 0 if there is no room.
+static struct lockclass*
+lockclass(char *name)
+{
+  struct lockclass *lc;
+
+  while(xchg(&lockclasses.lock, 1) != 0)
+    ;
+  for(lc = lockclasses.class; lc < &lockclasses.class[lockclasses.n]; lc++)
+    if(lc->name == name || strncmp(lc->name, name, 16) == 0)
+      goto found;
+  if(lockclasses.n == NLOCKCLASS)
+    lc = 0;
+  else {
+    lc->name = name;
+    lockclasses.n++;
+  }
+found:
+  xchg(&lockclasses.lock, 0);
+  return lc;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
+  lk->class = lockclass(name);
+#ifdef TICKETLOCK
+  lk->next = 0;
+  lk->owner = 0;
+#else
   lk->locked = 0;
+#endif
   lk->cpu = 0;
 }
 
@@ -24,13 +83,37 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 t0, spin;
+  int c;
+#ifdef TICKETLOCK
+  uint me, ahead, i;
+#endif
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+  spin = 0;
+#ifdef TICKETLOCK
+  // Take a ticket, and wait for it to come up, backing off
+  // in proportion to the number of CPUs ahead in line.
+  me = xadd(&lk->next, 1);
+  if(me != lk->owner){
+    t0 = rdtsc();
+    while((ahead = me - lk->owner) != 0)
+      for(i = ahead * BACKOFF; i > 0; i--)
+        pause();
+    spin = rdtsc() - t0;
+  }
+#else
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  if(xchg(&lk->locked, 1) != 0){
+    t0 = rdtsc();
+    while(xchg(&lk->locked, 1) != 0)
+      ;
+    spin = rdtsc() - t0;
+  }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,15 +123,35 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  if(lk->class){
+    c = lk->cpu - cpus;
+    lk->class->cpu[c].acquires++;
+    if(spin){
+      lk->class->cpu[c].contended++;
+      lk->class->cpu[c].spin += spin;
+    }
+    lk->t0 = rdtsc();
+  }
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint hold;
+  int c;
+
   if(!holding(lk))
     panic("release");
 
+  if(lk->class){
+    hold = (uint)rdtsc() - lk->t0;
+    c = lk->cpu - cpus;
+    if(hold > lk->class->cpu[c].maxhold)
+      lk->class->cpu[c].maxhold = hold;
+  }
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -59,10 +162,15 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
+#ifdef TICKETLOCK
+  // Let the next ticket in. Only the holder writes owner.
+  lk->owner++;
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code can't use a C assignment, since it might
   // not be atomic. A real OS would use C atomics here.
   asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+#endif
 
   popcli();
 }
@@ -91,12 +199,143 @@ holding(struct spinlock *lock)
 {
   int r;
   pushcli();
+#ifdef TICKETLOCK
+  r = lock->next != lock->owner && lock->cpu == mycpu();
+#else
   r = lock->locked && lock->cpu == mycpu();
+#endif
   popcli();
   return r;
 }
 
 
+//PAGEBREAK!
+// Reader-writer spin locks.
+
+#define RW_WRITER 0x80000000  // held for writing
+#define RW_WAIT   0x40000000  // a writer is waiting
+
+// Count an acquire of a lock of class lc that spun for spin cycles.
+// Caller must have interrupts off.
+static void
+lockcount(struct lockclass *lc, uint64 spin)
+{
+  int c;
+
+  if(lc == 0)
+    return;
+  c = mycpu() - cpus;
+  lc->cpu[c].acquires++;
+  if(spin){
+    lc->cpu[c].contended++;
+    lc->cpu[c].spin += spin;
+  }
+}
+
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->name = name;
+  lk->class = lockclass(name);
+  lk->rw = 0;
+  lk->cpu = 0;
+}
+
+// Acquire the lock for reading, alongside other readers.
+void
+acquirerd(struct rwlock *lk)
+{
+  uint64 t0, spin;
+
+  pushcli();
+  if(holdingwr(lk))
+    panic("acquirerd");
+
+  spin = 0;
+  t0 = 0;
+  for(;;){
+    if((lk->rw & (RW_WRITER|RW_WAIT)) == 0){
+      // Count ourselves in, then look again: a writer
+      // may have got in first.
+      if((xadd(&lk->rw, 1) & RW_WRITER) == 0)
+        break;
+      xadd(&lk->rw, -1);
+    }
+    if(t0 == 0)
+      t0 = rdtsc();
+    pause();
+  }
+  if(t0)
+    spin = rdtsc() - t0;
+  __sync_synchronize();
+  lockcount(lk->class, spin);
+}
+
+void
+releaserd(struct rwlock *lk)
+{
+  if((lk->rw & ~(RW_WRITER|RW_WAIT)) == 0)
+    panic("releaserd");
+  __sync_synchronize();
+  xadd(&lk->rw, -1);
+  popcli();
+}
+
+// Acquire the lock for writing, excluding everyone else.
+void
+acquirewr(struct rwlock *lk)
+{
+  uint64 t0, spin;
+  uint v;
+
+  pushcli();
+  if(holdingwr(lk))
+    panic("acquirewr");
+
+  spin = 0;
+  t0 = 0;
+  for(;;){
+    v = lk->rw;
+    if((v & ~RW_WAIT) == 0 && cmpxchg(&lk->rw, v, RW_WRITER) == v)
+      break;
+    // Ask new readers to wait.
+    if((v & RW_WAIT) == 0)
+      cmpxchg(&lk->rw, v, v | RW_WAIT);
+    if(t0 == 0)
+      t0 = rdtsc();
+    pause();
+  }
+  if(t0)
+    spin = rdtsc() - t0;
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  lockcount(lk->class, spin);
+}
+
+void
+releasewr(struct rwlock *lk)
+{
+  if(!holdingwr(lk))
+    panic("releasewr");
+  lk->cpu = 0;
+  __sync_synchronize();
+  // Leave RW_WAIT alone: another writer may have set it.
+  xadd(&lk->rw, -RW_WRITER);
+  popcli();
+}
+
+// Check whether this cpu holds the lock for writing.
+int
+holdingwr(struct rwlock *lk)
+{
+  int r;
+
+  pushcli();
+  r = (lk->rw & RW_WRITER) && lk->cpu == mycpu();
+  popcli();
+  return r;
+}
+
 // Pushcli/popcli are like cli/sti except that they are matched:
 // it takes two popcli to undo two pushcli.  Also, if interrupts
 // are off, then pushcli, popcli leaves them off.
@@ -124,3 +363,28 @@ popcli(void)
     sti();
 }
 
+// Copy lock statistics out for the lockstat system call,
+// summed over CPUs. Returns the number of lock names, at
+// most n.
+int
+lockstat(struct lockstat *st, int n)
+{
+  struct lockclass *lc;
+  int i, j;
+
+  if(n > lockclasses.n)
+    n = lockclasses.n;
+  for(i = 0; i < n; i++){
+    lc = &lockclasses.class[i];
+    memset(&st[i], 0, sizeof(st[i]));
+    safestrcpy(st[i].name, lc->name, sizeof(st[i].name));
+    for(j = 0; j < ncpu; j++){
+      st[i].acquires += lc->cpu[j].acquires;
+      st[i].contended += lc->cpu[j].contended;
+      st[i].spin += lc->cpu[j].spin;
+      if(lc->cpu[j].maxhold > st[i].maxhold)
+        st[i].maxhold = lc->cpu[j].maxhold;
+    }
+  }
+  return n;
+}
@@ -1,6 +1,18 @@
 // Mutual exclusion lock.
+//
+// By default a test-and-set lock. Built with TICKETLOCK (make
+// LOCK=TICKET), a ticket lock: CPUs get the lock in the order
+// they asked for it, and wait without writing to it.
 struct spinlock {
+#ifdef TICKETLOCK
+  uint next;         // Next ticket to hand out.
+  volatile uint owner;  // Ticket now holding the lock.
+#else
   uint locked;       // Is the lock held?
+#endif
+
+  struct lockclass *class;  // Statistics, shared by locks of this name.
+  uint t0;           // When the lock was acquired (low bits of rdtsc).
 
   // For debugging:
   char *name;        // Name of lock.
@@ -9,3 +21,14 @@ struct spinlock {
                      // that locked the lock.
 };
 
+// Reader-writer spin lock: any number of readers, or one
+// writer. A writer waiting for the readers to leave holds
+// off new ones, so that a stream of readers cannot starve it.
+struct rwlock {
+  volatile uint rw;  // Readers, plus the RW_WRITER and RW_WAIT bits.
+  struct lockclass *class;  // Statistics, shared by locks of this name.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding the lock for writing.
+};
@@ -13,34 +13,74 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Fault in the pages of [addr, addr+n) in the current process,
+// writable if write is set. Only to save faults in the middle of
+// a system call: the kernel copies user memory with umemcpy(),
+// which copes if another thread unmaps a page in the meantime.
+static int
+prefault(uint addr, uint n, int write)
+{
+  uint a;
+
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE)
+    if(pagefault(myproc(), a, write) < 0)
+      return -1;
+  return 0;
+}
+
+// Copy n bytes at user address addr in the current process
+// to dst. Returns -1 if they are not all user memory.
+int
+fetchmem(void *dst, uint addr, uint n)
+{
+  if(addr + n < addr || addr + n > KERNBASE)
+    return -1;
+  return umemcpy(dst, (void*)addr, n);
+}
+
+// Copy n bytes from src to user address addr in the current
+// process. Returns -1 if they are not all writable user memory.
+int
+storemem(uint addr, void *src, uint n)
+{
+  if(addr + n < addr || addr + n > KERNBASE)
+    return -1;
+  return umemcpy((void*)addr, src, n);
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->leader->sz || addr+4 > curproc->leader->sz)
     return -1;
-  *ip = *(int*)(addr);
-  return 0;
+  return fetchmem(ip, addr, 4);
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
+// Fetch the nul-terminated string at addr from the current process
+// into buf, which holds max bytes.
 // Returns length of string, not including nul.
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-  char *s, *ep;
-  struct proc *curproc = myproc();
+  char *s;
+  int i, n;
 
-  if(addr >= curproc->sz)
+  if(addr >= myproc()->leader->sz)
     return -1;
-  *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  for(i = 0; i < max; i += n){
+    // A page at a time: the bytes past the nul may not be mapped,
+    // but the rest of the page holding it is.
+    n = PGSIZE - (addr + i) % PGSIZE;
+    if(n > max - i)
+      n = max - i;
+    if(fetchmem(buf + i, addr + i, n) < 0)
+      return -1;
+    for(s = buf + i; s < buf + i + n; s++)
+      if(*s == 0)
+        return s - buf;
   }
   return -1;
 }
@@ -52,34 +92,56 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+fetchptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i+size < (uint)i)
+    return -1;
+  // The heap and stack end at sz; mmap() regions lie above it.
+  // prefault() checks each page.
+  if(size == 0 && (uint)i >= curproc->leader->sz)
+    return -1;
+  if(prefault(i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space, and fault it in.
+// The kernel must still use the memory only through umemcpy(),
+// fetchmem() or storemem(), since another thread can unmap it.
+int
+argptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 0);
+}
+
+// Like argptr, for memory the kernel is going to write to:
+// also check that it is writable, and break copy-on-write
+// sharing now rather than in the middle of the system call.
+int
+argptrw(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 1);
+}
+
+// Fetch the nth word-sized system call argument as a string,
+// copied into buf, which holds max bytes.
+// Returns length of string, not including nul.
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
   int addr;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -103,6 +165,26 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_kmemstat(void);
+extern int sys_slabstat(void);
+extern int sys_pcachestat(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_schedstat(void);
+extern int sys_setpriority(void);
+extern int sys_getpriority(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_semcreate(void);
+extern int sys_semwait(void);
+extern int sys_sempost(void);
+extern int sys_semclose(void);
+extern int sys_lockstat(void);
+extern int sys_bcachestat(void);
+extern int sys_setiosched(void);
+extern int sys_iostat(void);
+extern int sys_setidedma(void);
+extern int sys_idestat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,6 +208,26 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_kmemstat] sys_kmemstat,
+[SYS_slabstat] sys_slabstat,
+[SYS_pcachestat] sys_pcachestat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_schedstat] sys_schedstat,
+[SYS_setpriority] sys_setpriority,
+[SYS_getpriority] sys_getpriority,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_semcreate] sys_semcreate,
+[SYS_semwait] sys_semwait,
+[SYS_sempost] sys_sempost,
+[SYS_semclose] sys_semclose,
+[SYS_lockstat] sys_lockstat,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_setiosched] sys_setiosched,
+[SYS_iostat]  sys_iostat,
+[SYS_setidedma] sys_setidedma,
+[SYS_idestat] sys_idestat,
 };
 
 void
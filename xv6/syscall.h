@@ -20,3 +20,23 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_kmemstat 22
+#define SYS_slabstat 23
+#define SYS_pcachestat 24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_schedstat 27
+#define SYS_setpriority 28
+#define SYS_getpriority 29
+#define SYS_clone  30
+#define SYS_join   31
+#define SYS_semcreate 32
+#define SYS_semwait 33
+#define SYS_sempost 34
+#define SYS_semclose 35
+#define SYS_lockstat 36
+#define SYS_bcachestat 37
+#define SYS_setiosched 38
+#define SYS_iostat 39
+#define SYS_setidedma 40
+#define SYS_idestat 41
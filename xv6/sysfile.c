@@ -15,54 +15,35 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return the corresponding struct file, with a reference that
+// the caller must drop with fileclose().
 static int
-argfd(int n, int *pfd, struct file **pf)
+argfd(int n, struct file **pf)
 {
   int fd;
-  struct file *f;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((*pf = fdget(fd)) == 0)
     return -1;
-  if(pfd)
-    *pfd = fd;
-  if(pf)
-    *pf = f;
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-  struct proc *curproc = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 int
 sys_dup(void)
 {
   struct file *f;
   int fd;
 
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,58 +51,69 @@ int
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = -1;
+  if(argint(2, &n) >= 0 && argptrw(1, &p, n) >= 0)
+    r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  return filewrite(f, p, n);
+  r = -1;
+  if(argint(2, &n) >= 0 && argptr(1, &p, n) >= 0)
+    r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
 sys_close(void)
 {
   int fd;
-  struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
-  fileclose(f);
-  return 0;
+  return fdclose(fd);
 }
 
 int
 sys_fstat(void)
 {
   struct file *f;
-  struct stat *st;
+  struct stat st;
+  char *ust;
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, &st);
+  fileclose(f);
+  if(r < 0 || argptrw(1, &ust, sizeof(st)) < 0)
+    return -1;
+  return storemem((uint)ust, &st, sizeof(st));
 }
 
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  if(argstr(0, old, sizeof(old)) < 0 || argstr(1, new, sizeof(new)) < 0)
     return -1;
 
   begin_op();
@@ -186,10 +178,10 @@ sys_unlink(void)
 {
   struct inode *ip, *dp;
   struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ], path[MAXPATH];
   uint off;
 
-  if(argstr(0, &path) < 0)
+  if(argstr(0, path, sizeof(path)) < 0)
     return -1;
 
   begin_op();
@@ -285,12 +277,12 @@ create(char *path, short type, short major, short minor)
 int
 sys_open(void)
 {
-  char *path;
+  char path[MAXPATH];
   int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, &omode) < 0)
     return -1;
 
   begin_op();
@@ -314,9 +306,7 @@ sys_open(void)
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -329,17 +319,22 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  // Only now may other threads find f.
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
 int
 sys_mkdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -352,11 +347,11 @@ int
 sys_mknod(void)
 {
   struct inode *ip;
-  char *path;
+  char path[MAXPATH];
   int major, minor;
 
   begin_op();
-  if((argstr(0, &path)) < 0 ||
+  if((argstr(0, path, sizeof(path))) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
@@ -371,12 +366,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
   struct proc *curproc = myproc();
   
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -396,49 +391,122 @@ sys_chdir(void)
 int
 sys_exec(void)
 {
-  char *path, *argv[MAXARG];
-  int i;
+  char path[MAXPATH], *argv[MAXARG];
+  int i, r;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
   memset(argv, 0, sizeof(argv));
+  r = -1;
   for(i=0;; i++){
     if(i >= NELEM(argv))
-      return -1;
+      goto bad;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-      return -1;
+      goto bad;
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
-    if(fetchstr(uarg, &argv[i]) < 0)
-      return -1;
+    // Each argument gets a page, like the user stack exec builds.
+    if((argv[i] = kalloc()) == 0 || fetchstr(uarg, argv[i], PGSIZE) < 0)
+      goto bad;
   }
-  return exec(path, argv);
+  r = exec(path, argv);
+
+ bad:
+  for(i = 0; i < NELEM(argv) && argv[i]; i++)
+    kfree(argv[i]);
+  return r;
 }
 
 int
 sys_pipe(void)
 {
-  int *fd;
+  char *ufd;
   struct file *rf, *wf;
-  int fd0, fd1;
+  int fd[2], fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptrw(0, &ufd, sizeof(fd)) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
-    fileclose(rf);
+      fdclose(fd0);
+    else
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   fd[0] = fd0;
   fd[1] = fd1;
+  if(storemem((uint)ufd, fd, sizeof(fd)) < 0){
+    fdclose(fd0);
+    fdclose(fd1);
+    return -1;
+  }
   return 0;
 }
+
+// Map a file, or anonymous memory, into the address space.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  int addr, len, prot, flags, off, vflags;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  vflags = 0;
+  if(prot & PROT_WRITE)
+    vflags |= VMA_WRITE;
+  if(flags & MAP_SHARED)
+    vflags |= VMA_SHARED;
+
+  ip = 0;
+  if(!(flags & MAP_ANON)){
+    if(argfd(4, &f) < 0)
+      return -1;
+    if(f->type != FD_INODE || !f->readable ||
+       ((vflags & VMA_SHARED) && (vflags & VMA_WRITE) && !f->writable)){
+      fileclose(f);
+      return -1;
+    }
+    ip = f->ip;
+    ilock(ip);
+    if(ip->type != T_FILE){
+      iunlock(ip);
+      fileclose(f);
+      return -1;
+    }
+    iunlock(ip);
+  }
+  vmlock(myproc());
+  addr = vmamap(myproc()->leader, addr, len, vflags, ip, off);
+  vmunlock(myproc());
+  if(ip)
+    fileclose(f);
+  return addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len, r;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  vmlock(myproc());
+  r = vmaunmap(myproc()->leader, addr, len);
+  vmunlock(myproc());
+  return r;
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "kstat.h"
 
 int
 sys_fork(void)
@@ -50,8 +51,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -89,3 +89,234 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// return physical page allocator counters.
+int
+sys_kmemstat(void)
+{
+  struct kmemstat st;
+  char *ust;
+
+  if(argptrw(0, &ust, sizeof(st)) < 0)
+    return -1;
+  kmemstat(&st);
+  return storemem((uint)ust, &st, sizeof(st));
+}
+
+// return counters for up to n slab caches.
+int
+sys_slabstat(void)
+{
+  struct slabstat *st;
+  char *ust;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(argptrw(0, &ust, n*sizeof(*st)) < 0)
+    return -1;
+  // Gather them in a page of kernel memory, then copy out.
+  if(n > PGSIZE/sizeof(*st))
+    n = PGSIZE/sizeof(*st);
+  if((st = (struct slabstat*)kalloc()) == 0)
+    return -1;
+  n = slabstat(st, n);
+  if(storemem((uint)ust, st, n*sizeof(*st)) < 0)
+    n = -1;
+  kfree((char*)st);
+  return n;
+}
+
+// return spin lock counters, for at most n lock names.
+int
+sys_lockstat(void)
+{
+  struct lockstat *st;
+  char *ust;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(argptrw(0, &ust, n*sizeof(*st)) < 0)
+    return -1;
+  // Gather them in a page of kernel memory, then copy out.
+  if(n > PGSIZE/sizeof(*st))
+    n = PGSIZE/sizeof(*st);
+  if((st = (struct lockstat*)kalloc()) == 0)
+    return -1;
+  n = lockstat(st, n);
+  if(storemem((uint)ust, st, n*sizeof(*st)) < 0)
+    n = -1;
+  kfree((char*)st);
+  return n;
+}
+
+// return buffer cache counters.
+int
+sys_bcachestat(void)
+{
+  struct bcachestat st;
+  char *ust;
+
+  if(argptrw(0, &ust, sizeof(st)) < 0)
+    return -1;
+  bcachestat(&st);
+  return storemem((uint)ust, &st, sizeof(st));
+}
+
+int
+sys_setiosched(void)
+{
+  char name[16];
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  return setiosched(name);
+}
+
+// return I/O scheduler counters.
+int
+sys_iostat(void)
+{
+  struct iostat st;
+  char *ust;
+
+  if(argptrw(0, &ust, sizeof(st)) < 0)
+    return -1;
+  iostat(&st);
+  return storemem((uint)ust, &st, sizeof(st));
+}
+
+int
+sys_setidedma(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  return setidedma(on);
+}
+
+// return IDE driver counters.
+int
+sys_idestat(void)
+{
+  struct idestat st;
+  char *ust;
+
+  if(argptrw(0, &ust, sizeof(st)) < 0)
+    return -1;
+  idestat(&st);
+  return storemem((uint)ust, &st, sizeof(st));
+}
+
+// return page cache counters.
+int
+sys_pcachestat(void)
+{
+  struct pcachestat st;
+  char *ust;
+
+  if(argptrw(0, &ust, sizeof(st)) < 0)
+    return -1;
+  pcachestat(&st);
+  return storemem((uint)ust, &st, sizeof(st));
+}
+
+// return scheduler run queue counters.
+int
+sys_schedstat(void)
+{
+  struct schedstat st;
+  char *ust;
+
+  if(argptrw(0, &ust, sizeof(st)) < 0)
+    return -1;
+  schedstat(&st);
+  return storemem((uint)ust, &st, sizeof(st));
+}
+
+int
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
+
+int
+sys_getpriority(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getpriority(pid);
+}
+
+int
+sys_clone(void)
+{
+  int fn, arg, stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+int
+sys_join(void)
+{
+  char *stack;
+  uint ustack;
+  int pid;
+
+  if(argptrw(0, &stack, sizeof(ustack)) < 0)
+    return -1;
+  if((pid = join(&ustack)) >= 0 &&
+     storemem((uint)stack, &ustack, sizeof(ustack)) < 0)
+    return -1;
+  return pid;
+}
+
+int
+sys_semcreate(void)
+{
+  int value;
+
+  if(argint(0, &value) < 0)
+    return -1;
+  return semcreate(value);
+}
+
+int
+sys_semwait(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return semwait(id);
+}
+
+int
+sys_sempost(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return sempost(id);
+}
+
+int
+sys_semclose(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return semclose(id);
+}
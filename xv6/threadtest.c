@@ -0,0 +1,241 @@
+// Test that threads made by clone() share memory, that sbrk()
+// in one is seen by the others, as are files one opens or
+// closes, that exit() takes care of threads still running,
+// and that the kernel copes when one thread unmaps memory
+// another is reading into.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+#define NTHREAD 4
+#define N       10000
+#define NRACE   1000
+
+lock_t lock;
+volatile int counter;
+volatile char *heap;
+volatile int sharedfd;
+int racefd[2];
+char * volatile racebuf;
+
+void
+count(void *arg)
+{
+  int i;
+
+  for(i = 0; i < N; i++){
+    lock_acquire(&lock);
+    counter++;
+    lock_release(&lock);
+  }
+}
+
+void
+grow(void *arg)
+{
+  heap = sbrk(4096);
+  if(heap != (char*)-1)
+    heap[100] = *(int*)arg;
+}
+
+void
+opener(void *arg)
+{
+  sharedfd = open("threadfile", O_RDONLY);
+}
+
+void
+closer(void *arg)
+{
+  close(sharedfd);
+}
+
+void
+spin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// Read a byte at a time into racebuf while racetest() unmaps
+// it and forks under it. Each read takes a byte from the pipe
+// whether or not it can copy it out.
+void
+reader(void *arg)
+{
+  int i, n;
+
+  for(i = 0; i < NRACE; i++){
+    n = read(racefd[0], racebuf + 100, 1);
+    if(n != 1 && n != -1){
+      printf(1, "read returned %d\n", n);
+      exit();
+    }
+  }
+}
+
+void
+sharetest(void)
+{
+  int i;
+
+  printf(1, "threads share memory: ");
+  lock_init(&lock);
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(count, 0) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(1, "thread_join with no threads\n");
+    exit();
+  }
+  if(counter != NTHREAD*N){
+    printf(1, "counter %d, not %d\n", counter, NTHREAD*N);
+    exit();
+  }
+  printf(1, "ok\n");
+}
+
+void
+sbrktest(void)
+{
+  int v;
+
+  printf(1, "threads share sbrk: ");
+  v = 42;
+  if(thread_create(grow, &v) < 0 || thread_join() < 0){
+    printf(1, "thread failed\n");
+    exit();
+  }
+  if(heap == (char*)-1 || heap[100] != 42){
+    printf(1, "lost the thread's sbrk\n");
+    exit();
+  }
+  printf(1, "ok\n");
+}
+
+void
+filetest(void)
+{
+  char buf[8];
+  int fd;
+
+  printf(1, "threads share files: ");
+  fd = open("threadfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "hello", 5) != 5){
+    printf(1, "create failed\n");
+    exit();
+  }
+  close(fd);
+  if(thread_create(opener, 0) < 0 || thread_join() < 0){
+    printf(1, "thread failed\n");
+    exit();
+  }
+  if(sharedfd < 0 || read(sharedfd, buf, sizeof(buf)) != 5 ||
+     buf[0] != 'h' || buf[4] != 'o'){
+    printf(1, "cannot read the file the thread opened\n");
+    exit();
+  }
+  if(thread_create(closer, 0) < 0 || thread_join() < 0){
+    printf(1, "thread failed\n");
+    exit();
+  }
+  if(read(sharedfd, buf, 1) != -1){
+    printf(1, "file the thread closed still open\n");
+    exit();
+  }
+  unlink("threadfile");
+  printf(1, "ok\n");
+}
+
+void
+exittest(void)
+{
+  int i, pid;
+
+  printf(1, "exit with threads running: ");
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < NTHREAD; i++)
+      thread_create(spin, 0);
+    sleep(10);
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "wait failed\n");
+    exit();
+  }
+  printf(1, "ok\n");
+}
+
+void
+racetest(void)
+{
+  int i, pid;
+
+  printf(1, "read races munmap and fork: ");
+  if(pipe(racefd) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  racebuf = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(racebuf == MAP_FAILED || thread_create(reader, 0) < 0){
+    printf(1, "mmap or thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < NRACE; i++){
+    if(i % 2 == 0){
+      munmap(racebuf, 4096);
+      racebuf = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON,
+                     -1, 0);
+      if(racebuf == MAP_FAILED){
+        printf(1, "mmap failed\n");
+        exit();
+      }
+    } else {
+      // Makes racebuf copy-on-write.
+      pid = fork();
+      if(pid == 0)
+        exit();
+      if(pid < 0 || wait() != pid){
+        printf(1, "fork failed\n");
+        exit();
+      }
+    }
+    write(racefd[1], "x", 1);
+  }
+  if(thread_join() < 0){
+    printf(1, "thread_join failed\n");
+    exit();
+  }
+  close(racefd[0]);
+  close(racefd[1]);
+  printf(1, "ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  sharetest();
+  sbrktest();
+  filetest();
+  exittest();
+  racetest();
+  printf(1, "threadtest ok\n");
+  exit();
+}
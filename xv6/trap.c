@@ -13,6 +13,8 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+extern char umemcpyend[], umemcpyfail[];  // in ucopy.S
+int diskirq;   // IRQ of a PCI disk, set by its driver
 
 void
 tvinit(void)
@@ -48,11 +50,15 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    mycpu()->ticks++;
+    if(mycpu()->idle)
+      mycpu()->idleticks++;
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      schedboost();
     }
     lapiceoi();
     break;
@@ -71,6 +77,14 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_TLB:
+    tlbintr();
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Only to wake a halted scheduler(); see kick().
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -78,8 +92,31 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // The kernel touches user memory only in umemcpy(). Bring
+    // the page in, unless this CPU holds a spin lock, as that
+    // could sleep; if it can't, make umemcpy() return -1.
+    if(myproc() && (tf->cs&3) == 0 &&
+       tf->eip >= (uint)umemcpy && tf->eip < (uint)umemcpyend){
+      if(mycpu()->ncli > 0 || rcr2() >= KERNBASE ||
+         pagefault(myproc(), rcr2(), tf->err & FEC_WR) < 0)
+        tf->eip = (uint)umemcpyfail;
+      break;
+    }
+    // A page not brought in yet or a write to a copy-on-write
+    // page. Any other fault in the kernel is a bug.
+    if(myproc() && (tf->cs&3) == DPL_USER &&
+       pagefault(myproc(), rcr2(), tf->err & FEC_WR) == 0)
+      break;
+    // Otherwise a real fault.
+
   //PAGEBREAK: 13
   default:
+    if(diskirq != 0 && tf->trapno == T_IRQ0 + diskirq){
+      ideintr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -103,7 +140,7 @@ trap(struct trapframe *tf)
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER && schedtick())
     yield();
 
   // Check if the process has been killed since we yielded
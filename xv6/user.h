@@ -1,5 +1,13 @@
 struct stat;
 struct rtcdate;
+struct kmemstat;
+struct slabstat;
+struct pcachestat;
+struct schedstat;
+struct lockstat;
+struct bcachestat;
+struct iostat;
+struct idestat;
 
 // system calls
 int fork(void);
@@ -23,6 +31,26 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int kmemstat(struct kmemstat*);
+int slabstat(struct slabstat*, int);
+int pcachestat(struct pcachestat*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int schedstat(struct schedstat*);
+int setpriority(int, int);
+int getpriority(int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int semcreate(int);
+int semwait(int);
+int sempost(int);
+int semclose(int);
+int lockstat(struct lockstat*, int);
+int bcachestat(struct bcachestat*);
+int setiosched(char*);
+int iostat(struct iostat*);
+int setidedma(int);
+int idestat(struct idestat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -37,3 +65,13 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+
+// uthread.c
+typedef struct {
+  volatile uint locked;
+} lock_t;
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
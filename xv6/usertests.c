@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "kstat.h"
+#include "mman.h"
 
 char buf[8192];
 char name[3];
@@ -354,6 +356,56 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// several readers and writers on one pipe: each wakeup
+// goes to one waiter, who must pass it on.
+void
+pipe3(void)
+{
+  int fds[2], res[2], i, n, pid, total;
+  char c;
+
+  printf(1, "pipe3 test\n");
+  if(pipe(fds) != 0 || pipe(res) != 0){
+    printf(1, "pipe3: pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < 8; i++){
+    if((pid = fork()) < 0){
+      printf(1, "pipe3: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(res[0]);
+      if(i < 4){
+        close(fds[0]);
+        for(n = 0; n < 1000; n++)
+          write(fds[1], "x", 1);
+        exit();
+      }
+      close(fds[1]);
+      total = 0;
+      while(read(fds[0], &c, 1) == 1)
+        total++;
+      write(res[1], &total, sizeof(total));
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(res[1]);
+  total = 0;
+  while(read(res[0], &n, sizeof(n)) == sizeof(n))
+    total += n;
+  close(res[0]);
+  for(i = 0; i < 8; i++)
+    wait();
+  if(total != 4000){
+    printf(1, "pipe3: read %d bytes, not 4000\n", total);
+    exit();
+  }
+  printf(1, "pipe3 ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -457,6 +509,180 @@ mem(void)
   }
 }
 
+// copy-on-write fork: parent and child each see only their
+// own writes, including a write the kernel makes in read().
+void
+cowtest(void)
+{
+  char *a;
+  int fds[2], i, pid;
+
+  printf(1, "cow test\n");
+  a = sbrk(8*4096);
+  for(i = 0; i < 8*4096; i += 4096)
+    a[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "cow fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < 8*4096; i += 4096){
+      if(a[i] != 'p'){
+        printf(1, "cow child read wrong value\n");
+        exit();
+      }
+      a[i] = 'c';
+    }
+    write(fds[1], "x", 1);
+    if(read(fds[0], a + 3*4096, 1) != 1 || a[3*4096] != 'x'){
+      printf(1, "cow read into shared page failed\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+  for(i = 0; i < 8*4096; i += 4096){
+    if(a[i] != 'p'){
+      printf(1, "cow parent sees child's write\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-8*4096);
+  printf(1, "cow ok\n");
+}
+
+// sbrk only reserves address space: pages are allocated when
+// first touched, by the program or by the kernel in read().
+void
+lazytest(void)
+{
+  struct kmemstat st;
+  char *a;
+  int fds[2], nfree;
+
+  printf(1, "lazy sbrk test\n");
+  kmemstat(&st);
+  nfree = st.nfree;
+  a = sbrk(64*1024*1024);
+  if(a == (char*)-1){
+    printf(1, "lazy sbrk failed\n");
+    exit();
+  }
+  a[0] = 1;
+  a[64*1024*1024 - 1] = 2;
+  pipe(fds);
+  write(fds[1], "x", 1);
+  if(read(fds[0], a + 32*1024*1024, 1) != 1 || a[32*1024*1024] != 'x'){
+    printf(1, "lazy read into untouched page failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  kmemstat(&st);
+  if(nfree - (int)st.nfree > 1024){
+    printf(1, "lazy sbrk allocated %d pages\n", nfree - st.nfree);
+    exit();
+  }
+  sbrk(-64*1024*1024);
+  printf(1, "lazy sbrk ok\n");
+}
+
+// program text is shared between processes and read-only.
+void
+texttest(void)
+{
+  int pid, ppid;
+
+  printf(1, "text test\n");
+  ppid = getpid();
+  pid = fork();
+  if(pid == 0){
+    *(volatile char*)texttest = 0;
+    printf(1, "text test: wrote to text\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+  printf(1, "text ok\n");
+}
+
+// mmap: shared file mappings write through to the file and
+// are seen by private ones; shared anonymous memory is shared
+// with children.
+void
+mmaptest(void)
+{
+  char *p, *q;
+  int fd, i, pid;
+
+  printf(1, "mmap test\n");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 6000; i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, 6000) != 6000){
+    printf(1, "mmap test: create failed\n");
+    exit();
+  }
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED || p[5999] != buf[5999]){
+    printf(1, "mmap failed\n");
+    exit();
+  }
+  p[0] = 'X';
+  p[5000] = 'Y';
+  q[1] = 'Z';
+  if(q[0] != 'X' || p[1] != 'b'){
+    printf(1, "mmap: private and shared mappings disagree\n");
+    exit();
+  }
+  if(munmap(p, 6000) < 0 || munmap(q, 6000) < 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapfile", 0);
+  if(read(fd, buf, 6000) != 6000 || buf[0] != 'X' || buf[5000] != 'Y' ||
+     buf[1] != 'b'){
+    printf(1, "mmap: shared write not in file\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED){
+    printf(1, "mmap anon failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    p[0] = 42;
+    exit();
+  }
+  wait();
+  if(p[0] != 42){
+    printf(1, "mmap: anonymous memory not shared\n");
+    exit();
+  }
+  munmap(p, 4096);
+
+  p = mmap(0, 8192, PROT_READ, MAP_SHARED|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED || p[0] != 0 || p[8191] != 0){
+    printf(1, "mmap: read-only anonymous memory failed\n");
+    exit();
+  }
+  munmap(p, 8192);
+  printf(1, "mmap ok\n");
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1780,7 +2006,12 @@ main(int argc, char *argv[])
   iputtest();
 
   mem();
+  cowtest();
+  lazytest();
+  texttest();
+  mmaptest();
   pipe1();
+  pipe3();
   preempt();
   exitwait();
 
@@ -0,0 +1,75 @@
+// User-level threads, on top of clone() and join(), and
+// spin locks for them. Not part of ULIB, so that programs
+// without threads (forktest, in particular) stay small;
+// programs that use them link uthread.o (see Makefile).
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+
+#define TSTACKSIZE 8192
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+tstart(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  exit();
+}
+
+// Start a thread running fn(arg) on a stack of its own.
+// The thread exits when fn returns. Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  char *stack;
+  struct tstart *t;
+  int pid;
+
+  if((stack = malloc(TSTACKSIZE)) == 0)
+    return -1;
+  t = (struct tstart*)(stack + TSTACKSIZE) - 1;
+  t->fn = fn;
+  t->arg = arg;
+  if((pid = clone(tstart, t, t)) < 0)
+    free(stack);
+  return pid;
+}
+
+// Wait for a thread to exit and free its stack.
+// Returns its pid, or -1 if there are no threads.
+int
+thread_join(void)
+{
+  void *t;
+  int pid;
+
+  if((pid = join(&t)) >= 0)
+    free((char*)((struct tstart*)t + 1) - TSTACKSIZE);
+  return pid;
+}
+
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+}
+
+void
+lock_release(lock_t *lk)
+{
+  xchg(&lk->locked, 0);
+}
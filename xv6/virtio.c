@@ -0,0 +1,356 @@
+// virtio-blk disk driver, for legacy (virtio 0.9) PCI devices.
+// Takes the place of ide.c for the file system disk (see
+// kernelvirtio in the Makefile); the boot disk stays IDE.
+//
+// Requests come from iosched.c as with IDE, but go to the
+// device as soon as the virtqueue has room, so many commands
+// are on the disk at once. A command is a chain of descriptors:
+// a request header, one per buf of the (merged) command, and a
+// status byte. The device moves the data itself.
+//
+// If the device offers VIRTIO_F_EVENTIDX, the driver asks it to
+// interrupt only once 1/VDCOALESCE of the commands it holds are
+// done, rather than once per command.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+#include "kstat.h"
+
+#define SECTOR_SIZE   512
+#define VDMAXQ       1024  // largest queue size the driver handles
+#define VDMAXMERGE     16  // most blocks in one command
+#define VDCOALESCE      2
+
+// You must hold vdlock while manipulating the queue or the
+// counters.
+static struct spinlock vdlock;
+
+static ushort iobase;
+static uint nsector;        // disk capacity
+static int eventidx;        // device honours used_event
+static uint qsize;          // entries in the virtqueue
+static struct vdesc *desc;
+static volatile struct vavail *avail;
+static volatile struct vused *used;
+static ushort lastused;     // next used entry to look at
+static ushort freedesc;     // free descriptors, linked by next
+static uint nfree;
+static uint nbusy;          // commands on the disk
+
+// Per command, by its first descriptor.
+static struct vblkreq hdr[VDMAXQ];
+static uchar status[VDMAXQ];
+static struct buf *cmdbuf[VDMAXQ];
+
+static struct {
+  uint cmds;
+  uint blocks;
+  uint intrs;
+  uint maxbusy;
+  uint64 cycles;   // spent starting commands and in ideintr()
+} vdstat;
+
+void
+ideinit(void)
+{
+  struct pcidev *d;
+  uint i, n, order;
+  char *q;
+
+  initlock(&vdlock, "virtio");
+  if((d = pcifind(0x1AF4, 0x1001)) == 0)
+    panic("virtio: no block device");
+  if((d->bar[0] & PCI_BARIO) == 0)
+    panic("virtio: BAR0 not I/O");
+  pcienable(d);
+  iobase = d->bar[0] & ~3;
+
+  outb(iobase + VIRTIO_STATUS, 0);  // reset
+  outb(iobase + VIRTIO_STATUS, VIRTIO_ACK);
+  outb(iobase + VIRTIO_STATUS, VIRTIO_ACK | VIRTIO_DRIVER);
+  eventidx = (inl(iobase + VIRTIO_HOSTFEAT) >> VIRTIO_F_EVENTIDX) & 1;
+  outl(iobase + VIRTIO_GUESTFEAT, eventidx << VIRTIO_F_EVENTIDX);
+  nsector = inl(iobase + VIRTIO_BLK_CAP);
+
+  // Queue 0, laid out as the legacy interface requires: the
+  // descriptors, then the available ring and used_event, then
+  // on the next page the used ring.
+  outw(iobase + VIRTIO_QSEL, 0);
+  qsize = inw(iobase + VIRTIO_QSIZE);
+  if(qsize == 0 || qsize > VDMAXQ)
+    panic("virtio: queue size");
+  n = PGROUNDUP(qsize*sizeof(struct vdesc) + (3+qsize)*sizeof(ushort)) +
+      PGROUNDUP(3*sizeof(ushort) + qsize*sizeof(struct vusedelem));
+  for(order = 0; (PGSIZE << order) < n; order++)
+    ;
+  if((q = alloc_pages(order)) == 0)
+    panic("virtio: no memory for queue");
+  memset(q, 0, PGSIZE << order);
+  desc = (struct vdesc*)q;
+  avail = (struct vavail*)(q + qsize*sizeof(struct vdesc));
+  used = (struct vused*)(q + PGROUNDUP(qsize*sizeof(struct vdesc) +
+                                      (3+qsize)*sizeof(ushort)));
+  for(i = 0; i < qsize; i++)
+    desc[i].next = i+1;
+  freedesc = 0;
+  nfree = qsize;
+  outl(iobase + VIRTIO_QADDR, V2P(q) / VIRTIO_PAGE);
+
+  outb(iobase + VIRTIO_STATUS,
+       VIRTIO_ACK | VIRTIO_DRIVER | VIRTIO_DRIVEROK);
+
+  diskirq = d->irq;
+  ioapicenable(diskirq, ncpu - 1);
+}
+
+// Take a descriptor off the free list.  Caller must hold vdlock.
+static ushort
+vdalloc(void)
+{
+  ushort i;
+
+  if(nfree == 0)
+    panic("vdalloc");
+  i = freedesc;
+  freedesc = desc[i].next;
+  nfree--;
+  return i;
+}
+
+// Free the descriptors of the command starting at i.
+// Caller must hold vdlock.
+static void
+vdfree(ushort i)
+{
+  ushort next;
+
+  for(;;){
+    next = desc[i].next;
+    desc[i].next = freedesc;
+    freedesc = i;
+    nfree++;
+    if((desc[i].flags & VD_NEXT) == 0)
+      break;
+    i = next;
+  }
+}
+
+// Where the driver tells the device which used entry to
+// interrupt for.
+static volatile ushort*
+usedevent(void)
+{
+  return &avail->ring[qsize];
+}
+
+// Hand the command for b and the bufs linked to it, which are
+// for the blocks that follow, to the device.
+// Caller must hold vdlock.
+static void
+vdstart(struct buf *b)
+{
+  struct buf *m;
+  ushort head, d, prev;
+  int n;
+
+  head = vdalloc();
+  hdr[head].type = (b->flags & B_DIRTY) ? VIRTIO_BLK_OUT : VIRTIO_BLK_IN;
+  hdr[head].reserved = 0;
+  hdr[head].sector = (uint64)b->blockno * (BSIZE/SECTOR_SIZE);
+  status[head] = 0xFF;
+  cmdbuf[head] = b;
+  desc[head].addr = V2P(&hdr[head]);
+  desc[head].len = sizeof(hdr[head]);
+  desc[head].flags = VD_NEXT;
+  prev = head;
+  n = 0;
+  for(m = b; m; m = m->qnext){
+    if((m->blockno + 1) * (BSIZE/SECTOR_SIZE) > nsector)
+      panic("virtio: block out of range");
+    d = vdalloc();
+    desc[prev].next = d;
+    desc[d].addr = V2P(m->data);
+    desc[d].len = BSIZE;
+    desc[d].flags = VD_NEXT | ((b->flags & B_DIRTY) ? 0 : VD_WRITE);
+    prev = d;
+    n++;
+  }
+  d = vdalloc();
+  desc[prev].next = d;
+  desc[d].addr = V2P(&status[head]);
+  desc[d].len = 1;
+  desc[d].flags = VD_WRITE;
+
+  avail->ring[avail->idx % qsize] = head;
+  __sync_synchronize();  // descriptors before the index
+  avail->idx++;
+
+  nbusy++;
+  if(nbusy > vdstat.maxbusy)
+    vdstat.maxbusy = nbusy;
+  vdstat.cmds++;
+  vdstat.blocks += n;
+}
+
+// Start as many queued commands as the virtqueue has room for.
+// Caller must hold vdlock.
+static void
+vdnext(void)
+{
+  struct buf *b;
+  int started;
+
+  started = 0;
+  while(nfree >= VDMAXMERGE + 2 && (b = iodequeue(VDMAXMERGE)) != 0){
+    vdstart(b);
+    started = 1;
+  }
+  if(started){
+    __sync_synchronize();
+    outw(iobase + VIRTIO_QNOTIFY, 0);
+  }
+}
+
+// The disk is done with b.  Caller must hold vdlock.
+static void
+vddone(struct buf *b)
+{
+  iodone(b);
+
+  // Wake process waiting for this buf.
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  wakeup(b);
+
+  // No one is waiting for a read-ahead; release it.
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    basyncdone(b);
+  }
+}
+
+// Finish the commands the device has finished, start more,
+// and tell the device when to interrupt next.
+// Caller must hold vdlock.
+static void
+vdpoll(void)
+{
+  struct buf *b, *next;
+  ushort head;
+  uint k;
+
+  for(;;){
+    while(lastused != used->idx){
+      __sync_synchronize();  // the index before the entry
+      head = used->ring[lastused % qsize].id;
+      // Errors are ignored, as by ide.c.
+      for(b = cmdbuf[head]; b; b = next){
+        next = b->qnext;
+        vddone(b);
+      }
+      cmdbuf[head] = 0;
+      vdfree(head);
+      nbusy--;
+      lastused++;
+    }
+    vdnext();
+    if(!eventidx)
+      return;
+
+    // Interrupt when k more commands are done. The device may
+    // have finished some already, past the new used_event, and
+    // will not interrupt for them: look again.
+    k = nbusy / VDCOALESCE;
+    if(k == 0)
+      k = 1;
+    *usedevent() = lastused + k - 1;
+    __sync_synchronize();
+    if(lastused == used->idx)
+      return;
+  }
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  uint64 t0;
+
+  acquire(&vdlock);
+  t0 = rdtsc();
+  inb(iobase + VIRTIO_ISR);  // ack
+  vdstat.intrs++;
+  vdpoll();
+  vdstat.cycles += rdtsc() - t0;
+  release(&vdlock);
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return at once; ideintr() releases the
+// buf when the disk is done.
+void
+iderw(struct buf *b)
+{
+  uint64 t0;
+
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != ROOTDEV)
+    panic("iderw: request not for the virtio disk");
+
+  acquire(&vdlock);
+  t0 = rdtsc();
+  ioqueue(b);
+  vdpoll();
+  vdstat.cycles += rdtsc() - t0;
+
+  // Wait for request to finish, unless ideintr() is
+  // to release b.
+  if(b->flags & B_ASYNC){
+    release(&vdlock);
+    return;
+  }
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vdlock);
+  release(&vdlock);
+}
+
+// The device does all transfers itself.
+int
+setidedma(int on)
+{
+  return on ? 0 : -1;
+}
+
+// Copy the counters out for the idestat system call.
+void
+idestat(struct idestat *st)
+{
+  memset(st, 0, sizeof(*st));
+  safestrcpy(st->driver, "virtio", sizeof(st->driver));
+  st->dma = 1;
+  st->candma = 1;
+  acquire(&vdlock);
+  st->maxbusy = vdstat.maxbusy;
+  st->mode[1].cmds = vdstat.cmds;
+  st->mode[1].blocks = vdstat.blocks;
+  st->mode[1].intrs = vdstat.intrs;
+  st->mode[1].kcycles = vdstat.cycles >> 10;
+  release(&vdlock);
+}
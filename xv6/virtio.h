@@ -0,0 +1,64 @@
+// Legacy virtio over PCI, and the virtio block device.
+// See the Virtual I/O Device (VIRTIO) spec, version 1.0,
+// sections 2.4 (split virtqueues), 4.1.4.8 (legacy PCI
+// interface) and 5.2 (block device).
+
+// Registers, at offsets from the I/O port base in BAR0.
+#define VIRTIO_HOSTFEAT   0x00   // features the device offers
+#define VIRTIO_GUESTFEAT  0x04   // features the driver accepts
+#define VIRTIO_QADDR      0x08   // queue address, in pages
+#define VIRTIO_QSIZE      0x0C   // queue size (16 bits)
+#define VIRTIO_QSEL       0x0E   // queue select (16 bits)
+#define VIRTIO_QNOTIFY    0x10   // queue notify (16 bits)
+#define VIRTIO_STATUS     0x12   // device status (8 bits)
+  #define VIRTIO_ACK        0x01   // driver found the device
+  #define VIRTIO_DRIVER     0x02   // driver knows how to drive it
+  #define VIRTIO_DRIVEROK   0x04   // driver is ready
+  #define VIRTIO_FAILED     0x80
+#define VIRTIO_ISR        0x13   // interrupt status; reading acks
+#define VIRTIO_CONFIG     0x14   // device-specific configuration
+
+#define VIRTIO_F_EVENTIDX   29   // feature: used_event/avail_event
+
+#define VIRTIO_PAGE       4096   // legacy queue alignment
+
+// Virtqueue descriptor: one buffer of a request.
+struct vdesc {
+  uint64 addr;          // physical address
+  uint len;
+  ushort flags;
+  ushort next;          // next descriptor, if VD_NEXT
+};
+#define VD_NEXT   0x1   // request continues in next
+#define VD_WRITE  0x2   // device writes the buffer
+
+// Requests the driver has made available. ring[] has as many
+// entries as the queue and is followed by used_event.
+struct vavail {
+  ushort flags;
+  ushort idx;           // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct vusedelem {
+  uint id;              // first descriptor of the request
+  uint len;             // bytes the device wrote
+};
+
+// Requests the device has finished.
+struct vused {
+  ushort flags;
+  ushort idx;           // where the device puts the next entry
+  struct vusedelem ring[];
+};
+
+// Block device request header, and the first 32 bits of its
+// configuration: the capacity in 512-byte sectors.
+struct vblkreq {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+#define VIRTIO_BLK_IN     0     // read
+#define VIRTIO_BLK_OUT    1     // write
+#define VIRTIO_BLK_CAP    (VIRTIO_CONFIG + 0)
@@ -6,8 +6,13 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
 
 extern char data[];  // defined by kernel.ld
+static struct vma *vmalookup(struct vma*, uint);
 pde_t *kpgdir;  // for use in scheduler()
 
 // Set up CPU's kernel segment descriptors.
@@ -16,17 +21,34 @@ void
 seginit(void)
 {
   struct cpu *c;
+  int apicid;
+
+  // Find this CPU's struct cpu by its APIC ID; mycpu() only
+  // works once %gs is set up below.
+  apicid = lapicid();
+  for(c = cpus; c < &cpus[ncpu]; c++)
+    if(c->apicid == apicid)
+      break;
+  if(c == &cpus[ncpu])
+    panic("seginit: unknown apicid");
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map the cpu-local segment to c->self and c->proc.
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->self, 8, 0);
+
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
+
+  c->self = c;
+  c->proc = 0;
 }
 
 // Return the address of the PTE in page table pgdir
@@ -42,10 +64,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -121,9 +142,8 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -186,36 +206,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +226,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -310,40 +304,383 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Share the pages in [start, end) of pgdir with d; see copyuvm.
+static int
+copyrange(pde_t *pgdir, pde_t *d, uint start, uint end)
+{
+  pte_t *pte;
+  uint pa, i, flags;
+
+  for(i = start; i < end; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if((*pte & PTE_W) && !(*pte & PTE_SHARED))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kincref(P2V(pa));
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. No memory is copied: writable pages
+// are shared read-only and marked PTE_COW in both page
+// tables, and pagefault() copies them on the first write.
+// Pages of MAP_SHARED mappings stay writable in both.
+// Pages sbrk() reserved but never touched stay unmapped.
+// The caller must flush the parent's TLB.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
+  if(copyrange(pgdir, d, 0, sz) < 0 ||
+     copyrange(pgdir, d, MMAPBASE, KERNBASE) < 0){
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Give the address space a private, writable copy of the
+// copy-on-write page that *pte maps at va. If no one else
+// refers to the page any more, just make it writable again.
+static int
+cowcopy(pte_t *pte, uint va)
+{
+  uint pa;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  if(krefcount(P2V(pa)) > 1){
     if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | PTE_FLAGS(*pte);
+    kfree(P2V(pa));
+  }
+  *pte = (*pte | PTE_W) & ~PTE_COW;
+  invlpg((void*)va);
+  return 0;
+}
+
+// Fault in page va of region v, whose PTE is *pte.
+// Whole pages of file data are mapped from the page cache:
+// read-only, writable if the region is a writable shared
+// mapping, or copy-on-write if it is private. The page where
+// the file data ends and zero-fill begins gets a private copy.
+static int
+vmafault(struct vma *v, pte_t *pte, uint va, int write)
+{
+  uint off, perm;
+  char *mem;
+
+  if(write && !(v->flags & VMA_WRITE))
+    return -1;
+  perm = PTE_P | PTE_U;
+  if(v->flags & VMA_WRITE)
+    perm |= PTE_W;
+  if(v->flags & VMA_SHARED)
+    perm |= PTE_SHARED;
+  off = v->off + (va - v->start);
+  if(va >= v->zero){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    *pte = V2P(mem) | perm;
+    return 0;
+  }
+  ilock(v->ip);
+  if(va + PGSIZE > v->zero){
+    // The file data ends in this page.
+    if((mem = kalloc_zeroed()) != 0)
+      readi(v->ip, mem, off, v->zero - va);
+    iunlock(v->ip);
+    if(mem == 0)
+      return -1;
+    *pte = V2P(mem) | perm;
+    return 0;
+  }
+  mem = pcget(v->ip, off / PGSIZE);
+  iunlock(v->ip);
+  if(mem == 0)
+    return -1;
+  if(!(v->flags & VMA_WRITE) || (v->flags & VMA_SHARED)){
+    *pte = V2P(mem) | perm;
+    return 0;
+  }
+  // Share the cached page until the first write.
+  *pte = V2P(mem) | PTE_P | PTE_U | PTE_COW;
+  if(write)
+    return cowcopy(pte, va);
+  return 0;
+}
+
+// Handle a fault at user address va in an address space that
+// is pgdir, sz bytes long, with memory regions vma (or 0).
+// Fault in a page of a region; zero-fill any other page below
+// sz that sbrk() reserved but nobody has touched yet; and on a
+// write, copy a copy-on-write page.
+// Returns -1 if va is not a valid user address (for a write,
+// a writable one) or there is no memory for the page.
+static int
+uvmfault(pde_t *pgdir, uint sz, struct vma *vma, uint va, int write)
+{
+  pte_t *pte;
+  struct vma *v;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  v = 0;
+  if(vma)
+    v = vmalookup(vma, va);
+  if(v == 0 && va >= sz)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_P){
+    if((*pte & PTE_U) == 0)
+      return -1;
+    if(!write || (*pte & PTE_W))
+      return 0;
+    if((*pte & PTE_COW) == 0)
+      return -1;
+    if(cowcopy(pte, va) < 0)
+      return -1;
+    // Other threads may still see the old page.
+    tlbflush(pgdir);
+    return 0;
+  }
+  if(v)
+    return vmafault(v, pte, va, write);
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
+// Handle a page fault at user address va in process p, or fault
+// a page in before the kernel uses it on p's behalf.
+// May sleep, to read a file.
+int
+pagefault(struct proc *p, uint va, int write)
+{
+  int r;
+
+  vmlock(p);
+  r = uvmfault(p->pgdir, p->leader->sz, p->leader->vma, va, write);
+  vmunlock(p);
+  return r;
+}
+
+//PAGEBREAK!
+// Memory regions.
+
+// Return the region containing va, or 0.
+static struct vma*
+vmalookup(struct vma *vma, uint va)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++)
+    if(vma[i].end && va >= vma[i].start && va < vma[i].end)
+      return &vma[i];
+  return 0;
+}
+
+// Write the dirty pages of shared file mapping v that lie in
+// [start, end) back to the file, through the log, a few blocks
+// per transaction as filewrite() does. Pages past the end of
+// the file are not written.
+static void
+vmasync(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  pte_t *pte;
+  uint va, off, i, n;
+  char *mem;
+
+  if((v->flags & (VMA_SHARED|VMA_WRITE)) != (VMA_SHARED|VMA_WRITE) || v->ip == 0)
+    return;
+  for(va = start; va < end; va += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)va, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    *pte &= ~PTE_D;
+    mem = P2V(PTE_ADDR(*pte));
+    off = v->off + (va - v->start);
+    for(i = 0; i < PGSIZE; i += n){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_op();
+      ilock(v->ip);
+      if(off + i >= v->ip->size)
+        n = PGSIZE - i;  // nothing more to write
+      else {
+        if(n > v->ip->size - (off + i))
+          n = v->ip->size - (off + i);
+        writei(v->ip, mem + i, off + i, n);
+      }
+      iunlock(v->ip);
+      end_op();
     }
   }
-  return d;
+}
+
+// Map len bytes of file ip (0 for anonymous memory) at file
+// offset off into the address space of process p (a leader,
+// with its address space locked), at addr if that range is free
+// and otherwise wherever there is room above MMAPBASE.
+// Anonymous shared memory is allocated at once, so that
+// fork() can share it; everything else is faulted in.
+// Returns the address, or -1.
+int
+vmamap(struct proc *p, uint addr, uint len, int flags, struct inode *ip, uint off)
+{
+  struct vma *v, *fv;
+  uint a;
+  int i;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if(len == 0 || len > KERNBASE - MMAPBASE)
+    return -1;
+  fv = 0;
+  for(i = 0; i < NVMA; i++)
+    if(p->vma[i].end == 0){
+      fv = &p->vma[i];
+      break;
+    }
+  if(fv == 0)
+    return -1;
+
+  // First fit, starting at the hint.
+  a = MMAPBASE;
+  if(addr >= MMAPBASE && addr % PGSIZE == 0 && addr < KERNBASE - len)
+    a = addr;
+  for(;;){
+    if(a > KERNBASE - len)
+      return -1;
+    for(i = 0; i < NVMA; i++){
+      v = &p->vma[i];
+      if(v->end && v->start < a + len && a < v->end){
+        a = v->end;
+        break;
+      }
+    }
+    if(i == NVMA)
+      break;
+  }
 
-bad:
-  freevm(d);
+  fv->start = a;
+  fv->end = a + len;
+  fv->off = off;
+  fv->flags = flags;
+  fv->ip = ip ? idup(ip) : 0;
+  fv->zero = ip ? fv->end : fv->start;
+  if(ip == 0 && (flags & VMA_SHARED)){
+    for(; a < fv->end; a += PGSIZE){
+      if(uvmfault(p->pgdir, p->sz, p->vma, a, (flags & VMA_WRITE) != 0) < 0){
+        vmaunmap(p, fv->start, len);
+        return -1;
+      }
+    }
+  }
+  return fv->start;
+}
+
+// Remove [addr, addr+len) from the memory regions mapped with
+// vmamap() into the address space of leader p, which must be
+// locked, writing dirty shared pages back to their files.
+// A region may shrink from either end, or split in two.
+// Returns -1 if addr is not page aligned, or a split needs a
+// free region slot and there is none.
+int
+vmaunmap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v, *nv;
+  uint end, s, e;
+  int i, j;
+
+  end = PGROUNDUP(addr + len);
+  if(addr % PGSIZE != 0 || addr < MMAPBASE || end <= addr || end > KERNBASE)
+    return -1;
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->end == 0 || v->end <= addr || v->start >= end)
+      continue;
+    s = addr > v->start ? addr : v->start;
+    e = end < v->end ? end : v->end;
+    nv = 0;
+    if(s > v->start && e < v->end){
+      for(j = 0; j < NVMA; j++)
+        if(p->vma[j].end == 0)
+          nv = &p->vma[j];
+      if(nv == 0)
+        return -1;
+    }
+    vmasync(p->pgdir, v, s, e);
+    deallocuvm(p->pgdir, e, s);
+    if(nv){
+      *nv = *v;
+      nv->start = e;
+      nv->off = v->off + (e - v->start);
+      if(nv->ip)
+        idup(nv->ip);
+      v->end = s;
+    } else if(s == v->start && e == v->end){
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      v->end = 0;
+      v->ip = 0;
+    } else if(s == v->start){
+      v->off += e - v->start;
+      v->start = e;
+    } else
+      v->end = s;
+  }
+  tlbflush(p->pgdir);
   return 0;
 }
 
+// Drop all of a process's memory regions, writing dirty shared
+// pages back to their files. pgdir is its page table, or 0 if
+// no pages were ever mapped.
+void
+vmaclear(pde_t *pgdir, struct vma *vma)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->end == 0)
+      continue;
+    if(pgdir)
+      vmasync(pgdir, v, v->start, v->end);
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    v->end = 0;
+    v->ip = 0;
+  }
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -359,11 +696,13 @@ uva2ka(pde_t *pgdir, char *uva)
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
-// Copy len bytes from p to user address va in page table pgdir.
+// Copy len bytes from p to user address va in page table pgdir,
+// whose address space is sz bytes long.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// uvmfault ensures this only works for PTE_U pages below sz,
+// and faults in untouched and copy-on-write pages.
 int
-copyout(pde_t *pgdir, uint va, void *p, uint len)
+copyout(pde_t *pgdir, uint sz, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
@@ -371,6 +710,8 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if(uvmfault(pgdir, sz, 0, va0, 1) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;